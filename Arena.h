@@ -0,0 +1,65 @@
+#ifndef CLANG_MUTATE_ARENA_H
+#define CLANG_MUTATE_ARENA_H
+
+#include <memory>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace clang_mutate {
+
+// Storage for many objects of one type which all live as long as the
+// arena does. Objects are constructed in place in large blocks, so
+// that neighbours are contiguous in memory and there is no per-object
+// allocation overhead; everything is released together when the arena
+// is destroyed.
+template <typename T, size_t BlockSize = 1024>
+class Arena
+{
+public:
+    Arena() : m_size(0) {}
+    Arena(const Arena &) = delete;
+    Arena & operator=(const Arena &) = delete;
+
+    ~Arena()
+    {
+        for (size_t i = m_size; i > 0; --i)
+            at(i - 1)->~T();
+    }
+
+    template <typename... Args>
+    T * create(Args&&... args)
+    {
+        if (m_size == m_blocks.size() * BlockSize)
+            m_blocks.emplace_back(new Slot[BlockSize]);
+        T * obj = new (at(m_size)) T(std::forward<Args>(args)...);
+        ++m_size;
+        return obj;
+    }
+
+    size_t size() const { return m_size; }
+
+    void swap(Arena & that)
+    {
+        m_blocks.swap(that.m_blocks);
+        std::swap(m_size, that.m_size);
+    }
+
+    // Bytes held by the arena itself, not counting any memory that the
+    // objects allocate for themselves.
+    size_t bytesReserved() const
+    { return m_blocks.size() * BlockSize * sizeof(Slot); }
+
+private:
+    typedef typename std::aligned_storage<sizeof(T), alignof(T)>::type Slot;
+
+    T * at(size_t i)
+    { return reinterpret_cast<T*>(&m_blocks[i / BlockSize][i % BlockSize]); }
+
+    std::vector<std::unique_ptr<Slot[]> > m_blocks;
+    size_t m_size;
+};
+
+} // end namespace clang_mutate
+
+#endif
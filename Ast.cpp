@@ -4,6 +4,7 @@
 #include "TypeDBEntry.h"
 
 #include <iomanip>
+#include <memory>
 #include <sstream>
 
 using namespace clang_mutate;
@@ -13,6 +14,7 @@ const AstRef clang_mutate::NoAst;
 const SourceOffset clang_mutate::BadOffset = 0xBAD0FF5E;
 
 std::map<std::string, Ast::Field*> Ast::s_ast_fields;
+const Ast::Extras Ast::s_no_extras;
 
 TU & AstRef::tu() const
 { return *TUs[m_tu]; }
@@ -33,10 +35,10 @@ std::string AstRef::to_string() const
 template <typename T>
 AstRef Ast::impl_create(T * clang_obj, Requirements & required)
 {
-    TU & tu = *TUs[required.tu()];
+    TU & tu = *TUs.at(required.tu());
     AstRef ref = tu.nextAstRef();
     AstRef parent = required.parent();
-    tu.asts.push_back(new Ast(clang_obj,
+    tu.asts.push_back(tu.ast_arena.create(clang_obj,
                               ref,
                               required.parent(),
                               required.syn_ctx(),
@@ -55,7 +57,6 @@ AstRef Ast::impl_create(T * clang_obj, Requirements & required)
     ref->setScopePosition(required.scopePos());
     ref->setFreeVariables(required.variables());
     ref->setFreeFunctions(required.functions());
-    ref->setReplacements(required.replacements());
 
     ref->setIsFullStmt(Utils::is_full_stmt(clang_obj, parent, *required.CI()));
 
@@ -95,8 +96,8 @@ AstRef Ast::impl_create(T * clang_obj, Requirements & required)
 template AstRef Ast::impl_create<Stmt>(Stmt * stmt, Requirements & reqs);
 template AstRef Ast::impl_create<Decl>(Decl * stmt, Requirements & reqs);
 
-std::string Ast::srcFilename() const
-{ return m_counter.tu().filename; }
+const std::string & Ast::srcFilename() const
+{ return m_counter.tu().filename.str(); }
 
 Utils::Optional<AddressRange>
 Ast::binaryAddressRange() const
@@ -150,38 +151,80 @@ void Ast::setFieldDeclProperties(ASTContext * context,
 
     if (Type->isArrayType()) {
         const ArrayType *AT = context->getAsArrayType(Type);
-        m_base_type = AT->getElementType().getAsString();
+        extras().base_type = Symbol(AT->getElementType().getAsString());
         if (context->getAsConstantArrayType(Type))
-            m_array_length = context->getConstantArrayElementCount(
+            extras().array_length = context->getConstantArrayElementCount(
                                  context->getAsConstantArrayType(Type));
     }
     else {
-        m_base_type = Type.getAsString();
+        extras().base_type = Symbol(Type.getAsString());
     }
 
     if (D->isBitField()) {
         m_bit_field = true;
-        m_bit_field_width = D->getBitWidthValue(*context);
+        extras().bit_field_width = D->getBitWidthValue(*context);
     }
 }
 
 std::pair<AstRef, AstRef> Ast::stmt_range() const
 {
-    return std::make_pair(
-        counter(),
-        m_children.empty()
-        ? counter()
-        : m_children.back()->stmt_range().second);
+    return std::make_pair(counter(), AstRef(m_counter.tuid(), m_exit));
+}
+
+AstRef AstShift::apply(AstRef ref) const
+{
+    if (ref == NoAst)
+        return ref;
+    return AstRef(ref.tuid(), ref.counter() + counters);
+}
+
+SourceOffset AstShift::apply(SourceOffset offset) const
+{ return offset == BadOffset ? offset : offset + offsets; }
+
+SourcePos AstShift::apply(SourcePos pos) const
+{
+    if (!pos.isValid() || !from.isValid() || pos.getLine() < from.getLine())
+        return pos;
+    if (pos.getLine() == from.getLine())
+        return SourcePos(to.getLine(),
+                         pos.getColumn() + to.getColumn() - from.getColumn());
+    return SourcePos(pos.getLine() + to.getLine() - from.getLine(),
+                     pos.getColumn());
+}
+
+void Ast::relocate(const AstShift & shift)
+{
+    m_counter = shift.apply(m_counter);
+    m_parent = shift.apply(m_parent);
+    m_exit += shift.counters;
+    for (auto & child : m_children)
+        child = shift.apply(child);
+    for (auto & successor : m_successors)
+        successor = shift.apply(successor);
+
+    m_norm_start_off = shift.apply(m_norm_start_off);
+    m_norm_end_off = shift.apply(m_norm_end_off);
+    m_start_off = shift.apply(m_start_off);
+    m_end_off = shift.apply(m_end_off);
+    m_begin_loc = shift.apply(m_begin_loc);
+    m_end_loc = shift.apply(m_end_loc);
+
+    m_replacements = m_replacements.moved(shift.sites, shift.offsets);
 }
 
 bool Ast::is_ancestor_of(AstRef ast) const
 {
-    while (ast != NoAst) {
-        if (ast == counter())
-            return true;
-        ast = ast->parent();
-    }
-    return false;
+    return ast.tuid() == m_counter.tuid()
+        && ast.counter() >= entry_index()
+        && ast.counter() <= exit_index();
+}
+
+std::vector<AstRef> Ast::descendants() const
+{
+    std::vector<AstRef> ans;
+    for (AstCounter c = entry_index() + 1; c <= exit_index(); ++c)
+        ans.push_back(AstRef(m_counter.tuid(), c));
+    return ans;
 }
 
 // Register structs representing all of the AST fields.
@@ -210,29 +253,80 @@ std::map<std::string, Ast::Field*> & Ast::ast_fields()
     return s_ast_fields;
 }
 
+FieldPlan::FieldPlan(const std::set<std::string> & keys)
+{
+    for (auto & field : Ast::ast_fields()) {
+        if (keys.empty() || keys.find(field.first) != keys.end())
+            m_fields.push_back(field);
+    }
+}
+
 picojson::value Ast::toJSON(
         const std::set<std::string> & keys, bool include_aux) const
+{ return toJSON(FieldPlan(keys), include_aux); }
+
+picojson::value Ast::toJSON(const FieldPlan & plan, bool include_aux) const
 {
     TU & tu = m_counter.tu();
     Ast & ast = *m_counter;
-    std::map<std::string, picojson::value> ans;
+    picojson::value ans((picojson::object()));
+    picojson::object & obj = ans.get<picojson::object>();
 
-    for (auto & field : ast_fields()) {
-        if (!keys.empty() && keys.find(field.first) == keys.end())
-            continue;
-        if (field.second->has_field(tu, ast)) {
-            ans[field.first] = field.second->to_json(tu, ast);
-        }
+    for (auto & field : plan) {
+        if (field.second->has_field(tu, ast))
+            obj[field.first] = field.second->to_json(tu, ast);
     }
 
     if (include_aux) {
-        picojson::value aux = to_json(m_aux);
+        picojson::value aux = to_json(extras().aux);
         assert(aux.is<picojson::object>());
         for (auto & field : aux.get<picojson::object>()) {
-            ans[field.first] = field.second;
+            obj[field.first] = field.second;
+        }
+    }
+    return ans;
+}
+
+void Ast::writeRecord(std::ostream & out,
+                      const RecordSyntax & syntax,
+                      const FieldPlan & plan,
+                      bool include_aux) const
+{
+    TU & tu = m_counter.tu();
+    Ast & ast = *m_counter;
+
+    picojson::object aux;
+    if (include_aux) {
+        picojson::value value = to_json(extras().aux);
+        assert(value.is<picojson::object>());
+        aux.swap(value.get<picojson::object>());
+    }
+
+    // Merge the fields with the aux entries in key order, as toJSON
+    // does; an aux entry takes the place of a field with its name.
+    bool first = true;
+    auto write = [&](const std::string & key, const picojson::value & value)
+    {
+        syntax.field(out, first, key, value);
+        first = false;
+    };
+
+    syntax.begin_record(out);
+    auto next_aux = aux.begin();
+    for (auto & field : plan) {
+        for (; next_aux != aux.end() && next_aux->first < field.first;
+             ++next_aux)
+        {
+            write(next_aux->first, next_aux->second);
         }
+        if (next_aux != aux.end() && next_aux->first == field.first)
+            continue;
+        if (field.second->has_field(tu, ast))
+            write(field.first, field.second->to_json(tu, ast));
     }
-    return to_json(ans);
+    for (; next_aux != aux.end(); ++next_aux)
+        write(next_aux->first, next_aux->second);
+    syntax.end_record(out);
 }
 
 bool Ast::has_bytes() const
@@ -317,18 +411,18 @@ void Ast::update_range_offsets(CompilerInstance * ci)
 
     // If this is a Var and our most recent sibling is too, make sure that
     // our ranges don't overlap. If they do, cut this one short.
-    if (className() == "Var") {
+    if (className() == AstClass::Var) {
         TU & tu = counter().tu();
         AstRef prev = NoAst;
         if (parent() == NoAst && counter().counter() >= 2) {
             prev = tu.asts[counter().counter() - 2]->counter();
             while (prev->parent() != NoAst)
                 prev = prev->parent();
-            if (prev->className() != "Var" || prev->isFullStmt())
+            if (prev->className() != AstClass::Var || prev->isFullStmt())
                 prev = NoAst;
         }
         else if (parent() != NoAst &&
-                 parent()->className() == "DeclStmt" &&
+                 parent()->className() == AstClass::DeclStmt &&
                  !parent()->children().empty())
         {
             prev = parent()->children().back();
@@ -369,9 +463,9 @@ void Ast::update_range_offsets(CompilerInstance * ci)
                           m_start_off : offset;
         }
     }
-    if (className() == "ParmVar" &&
+    if (className() == AstClass::ParmVar &&
         !parent()->children().empty() &&
-        parent()->children().back()->className() == "ParmVar")
+        parent()->children().back()->className() == AstClass::ParmVar)
     {
         // We are a parameter, but not the first one. Extend our sibling's
         // normalized range forward until it reaches a comma.
@@ -411,48 +505,45 @@ Ast::Ast(Stmt * _stmt,
          SourceRange nr,
          PresumedLoc pBegin,
          PresumedLoc pEnd)
-    : m_stmt(_stmt)
-    , m_decl(NULL)
-    , m_counter(_counter)
+    : m_counter(_counter)
     , m_parent(_parent)
+    , m_exit(_counter.counter())
+    , m_syn_ctx(syn_ctx)
+    , m_is_decl(false)
+    , m_guard(false)
+    , m_full_stmt(false)
+    , m_in_macro_expansion(false)
+    , m_can_have_compilation_data(false)
+    , m_field_decl(false)
+    , m_bit_field(false)
+    , m_is_member_expr(false)
+    , m_scope_pos(NoNode)
+    , m_expr_type(0)
+    , m_class(_stmt->getStmtClassName())
+    , m_opcode()
+    , m_stmt(_stmt)
     , m_children()
-    , m_class(std::string(_stmt->getStmtClassName()))
     , m_range(r)
     , m_normalized_range(nr)
     , m_begin_loc(pBegin)
     , m_end_loc(pEnd)
     , m_declares()
-    , m_guard(false)
-    , m_expr_type(0)
-    , m_scope_pos(NoNode)
     , m_macros()
     , m_free_vars()
     , m_free_funs()
-    , m_opcode("")
-    , m_full_stmt(false)
-    , m_in_macro_expansion(false)
-    , m_syn_ctx(syn_ctx)
-    , m_can_have_compilation_data(false)
     , m_replacements()
-    , m_field_decl(false)
-    , m_base_type()
-    , m_bit_field(false)
-    , m_bit_field_width(0)
-    , m_array_length(0)
-    , m_label_name()
-    , m_is_member_expr(false)
 {
     if (isa<BinaryOperator>(m_stmt)) {
-        m_opcode = static_cast<BinaryOperator*>(m_stmt)
-            ->getOpcodeStr().str();
+        m_opcode = Symbol(static_cast<BinaryOperator*>(m_stmt)
+                          ->getOpcodeStr().str());
     }
     if (isa<UnaryOperator>(m_stmt)) {
-      m_opcode = static_cast<UnaryOperator*>(m_stmt)
-	->getOpcodeStr(static_cast<UnaryOperator*>(m_stmt)->getOpcode()).str();
+      m_opcode = Symbol(static_cast<UnaryOperator*>(m_stmt)
+	->getOpcodeStr(static_cast<UnaryOperator*>(m_stmt)->getOpcode()).str());
     }
 
     if (isa<MemberExpr>(m_stmt)) {
-      m_label_name = static_cast<MemberExpr*>(m_stmt)
+      extras().label_name = static_cast<MemberExpr*>(m_stmt)
 	->getMemberDecl()->getNameAsString();
       m_is_member_expr = true;
     }
@@ -466,36 +557,33 @@ Ast::Ast(Decl * _decl,
          SourceRange nr,
          PresumedLoc pBegin,
          PresumedLoc pEnd)
-    : m_stmt(NULL)
-    , m_decl(_decl)
-    , m_counter(_counter)
+    : m_counter(_counter)
     , m_parent(_parent)
+    , m_exit(_counter.counter())
+    , m_syn_ctx(syn_ctx)
+    , m_is_decl(true)
+    , m_guard(false)
+    , m_full_stmt(false)
+    , m_in_macro_expansion(false)
+    , m_can_have_compilation_data(false)
+    , m_field_decl(false)
+    , m_bit_field(false)
+    , m_is_member_expr(false)
+    , m_scope_pos(NoNode)
+    , m_expr_type(0)
+    , m_class(_decl->getDeclKindName())
+    , m_opcode()
+    , m_decl(_decl)
     , m_children()
-    , m_class(std::string(_decl->getDeclKindName()))
     , m_range(r)
     , m_normalized_range(nr)
     , m_begin_loc(pBegin)
     , m_end_loc(pEnd)
     , m_declares()
-    , m_guard(false)
-    , m_expr_type(0)
-    , m_scope_pos(NoNode)
     , m_macros()
     , m_free_vars()
     , m_free_funs()
-    , m_opcode("")
-    , m_full_stmt(false)
-    , m_in_macro_expansion(false)
-    , m_syn_ctx(syn_ctx)
-    , m_can_have_compilation_data(false)
     , m_replacements()
-    , m_field_decl(false)
-    , m_base_type()
-    , m_bit_field(false)
-    , m_bit_field_width(0)
-    , m_array_length(0)
-    , m_label_name()
-    , m_is_member_expr(false)
 {
     // clang seems to give us the wrong source ranges for FieldDecls.
     // Work around this by setting the range to the normalized range, which
@@ -505,6 +593,211 @@ Ast::Ast(Decl * _decl,
 
     //Get annotations from the declaration
     for (const auto *I : _decl->specific_attrs<AnnotateAttr>()) {
-        m_annotations.push_back(I->getAnnotation());
+        extras().annotations.push_back(I->getAnnotation());
     }
 }
+
+Ast::Ast()
+    : m_exit(0)
+    , m_norm_start_off(0)
+    , m_norm_end_off(0)
+    , m_start_off(0)
+    , m_end_off(0)
+    , m_syn_ctx(SyntacticContext::Generic())
+    , m_is_decl(false)
+    , m_guard(false)
+    , m_full_stmt(false)
+    , m_in_macro_expansion(false)
+    , m_can_have_compilation_data(false)
+    , m_field_decl(false)
+    , m_bit_field(false)
+    , m_is_member_expr(false)
+    , m_scope_pos(NoNode)
+    , m_expr_type(0)
+    , m_stmt(NULL)
+{}
+
+// Rough heap usage of standard containers (as implemented by
+// libstdc++): strings longer than the small-string buffer own a heap
+// block, and each element of a set lives in its own tree node.
+static size_t heap_usage(const std::string & s)
+{ return s.capacity() > 15 ? s.capacity() + 1 : 0; }
+
+template <typename T>
+static size_t heap_usage(const std::vector<T> & v)
+{ return v.capacity() * sizeof(T); }
+
+static size_t heap_usage(const std::vector<std::string> & v)
+{
+    size_t ans = v.capacity() * sizeof(std::string);
+    for (auto & s : v)
+        ans += heap_usage(s);
+    return ans;
+}
+
+template <typename T>
+static size_t heap_usage(const std::set<T> & s)
+{ return s.size() * (4 * sizeof(void*) + sizeof(T)); }
+
+static size_t heap_usage(const std::set<std::string> & s)
+{
+    size_t ans = s.size() * (4 * sizeof(void*) + sizeof(std::string));
+    for (auto & str : s)
+        ans += heap_usage(str);
+    return ans;
+}
+
+size_t Ast::memoryUsage() const
+{
+    size_t ans = sizeof(Ast)
+        + heap_usage(m_children)
+        + heap_usage(m_successors)
+        + heap_usage(m_declares)
+        + heap_usage(m_types)
+        + heap_usage(m_includes)
+        + heap_usage(m_macros)
+        + heap_usage(m_free_vars)
+        + heap_usage(m_free_funs);
+    for (auto & var : m_free_vars)
+        ans += heap_usage(var.getName());
+    for (auto & fun : m_free_funs)
+        ans += heap_usage(fun.getName());
+    if (m_extras) {
+        ans += sizeof(Extras)
+            + heap_usage(m_extras->label_name)
+            + heap_usage(m_extras->annotations)
+            + m_extras->aux.toJSON().serialize().size();
+    }
+    return ans;
+}
+
+void Ast::collectIdentifiers(std::set<const IdentifierInfo*> & ids) const
+{
+    for (auto & var : m_free_vars)
+        if (var.getId() != NULL)
+            ids.insert(var.getId());
+    for (auto & fun : m_free_funs)
+        if (fun.getId() != NULL)
+            ids.insert(fun.getId());
+}
+
+static void write_loc(BinaryWriter & out, const SourcePos & loc)
+{
+    out.put(loc.isValid());
+    if (loc.isValid()) {
+        out.put(uint64_t(loc.getLine()));
+        out.put(uint64_t(loc.getColumn()));
+    }
+}
+
+static SourcePos read_loc(BinaryReader & in)
+{
+    if (!in.get_bool())
+        return SourcePos();
+    unsigned line = in.get_uint();
+    unsigned col = in.get_uint();
+    return SourcePos(line, col);
+}
+
+void Ast::write(BinaryWriter & out) const
+{
+    const Extras & x = extras();
+    out.put(bool(m_is_decl));
+    out.put(m_counter);
+    out.put(m_parent);
+    out.put(uint64_t(m_exit));
+    out.put(m_children);
+    out.put(m_successors);
+    out.put(m_class.str());
+    write_loc(out, m_begin_loc);
+    write_loc(out, m_end_loc);
+    out.put(m_declares);
+    out.put(bool(m_guard));
+    out.put(m_types);
+    out.put(m_expr_type);
+    out.put(m_includes);
+    out.put(uint64_t(m_scope_pos + 1));
+    out.put(m_macros);
+    out.put(uint64_t(m_free_vars.size()));
+    for (auto & var : m_free_vars)
+        var.write(out);
+    out.put(uint64_t(m_free_funs.size()));
+    for (auto & fun : m_free_funs)
+        fun.write(out);
+    out.put(m_opcode.str());
+    out.put(bool(m_full_stmt));
+    out.put(bool(m_in_macro_expansion));
+    m_syn_ctx.write(out);
+    out.put(bool(m_can_have_compilation_data));
+    m_replacements.write(out);
+    x.aux.write(out);
+    out.put(bool(m_field_decl));
+    out.put(x.base_type.str());
+    out.put(bool(m_bit_field));
+    out.put(uint64_t(x.bit_field_width));
+    out.put(uint64_t(x.array_length));
+    out.put(x.label_name);
+    out.put(bool(m_is_member_expr));
+    out.put_signed(m_norm_start_off);
+    out.put_signed(m_norm_end_off);
+    out.put_signed(m_start_off);
+    out.put_signed(m_end_off);
+    out.put(x.annotations);
+}
+
+Ast * Ast::read(BinaryReader & in, Arena<Ast> & arena)
+{
+    Ast * ast = arena.create();
+    ast->m_is_decl = in.get_bool();
+    ast->m_counter = in.get_astref();
+    ast->m_parent = in.get_astref();
+    ast->m_exit = in.get_uint();
+    ast->m_children = in.get_astrefs();
+    ast->m_successors = in.get_astrefs();
+    ast->m_class = Symbol(in.get_string());
+    ast->m_begin_loc = read_loc(in);
+    ast->m_end_loc = read_loc(in);
+    ast->m_declares = in.get_strings();
+    ast->m_guard = in.get_bool();
+    for (size_t n = in.get_uint(); n > 0 && !in.fail(); --n)
+        ast->m_types.push_back(in.get_hash());
+    ast->m_expr_type = in.get_hash();
+    for (auto & include : in.get_strings())
+        ast->m_includes.insert(include);
+    ast->m_scope_pos = PTNode(in.get_uint()) - 1;
+    for (size_t n = in.get_uint(); n > 0 && !in.fail(); --n)
+        ast->m_macros.insert(in.get_hash());
+    for (size_t n = in.get_uint(); n > 0 && !in.fail(); --n)
+        ast->m_free_vars.insert(VariableInfo::read(in));
+    for (size_t n = in.get_uint(); n > 0 && !in.fail(); --n)
+        ast->m_free_funs.insert(FunctionInfo::read(in));
+    ast->m_opcode = Symbol(in.get_string());
+    ast->m_full_stmt = in.get_bool();
+    ast->m_in_macro_expansion = in.get_bool();
+    ast->m_syn_ctx = SyntacticContext::read(in);
+    ast->m_can_have_compilation_data = in.get_bool();
+    ast->m_replacements = Replacements::read(in);
+
+    Extras x;
+    x.aux.read(in);
+    ast->m_field_decl = in.get_bool();
+    x.base_type = Symbol(in.get_string());
+    ast->m_bit_field = in.get_bool();
+    x.bit_field_width = in.get_uint();
+    x.array_length = in.get_uint();
+    x.label_name = in.get_string();
+    ast->m_is_member_expr = in.get_bool();
+    ast->m_norm_start_off = in.get_signed();
+    ast->m_norm_end_off = in.get_signed();
+    ast->m_start_off = in.get_signed();
+    ast->m_end_off = in.get_signed();
+    x.annotations = in.get_strings();
+    if (!x.base_type.empty() || x.bit_field_width != 0 ||
+        x.array_length != 0 || !x.label_name.empty() ||
+        !x.annotations.empty() || !x.aux.empty())
+    {
+        ast->extras() = x;
+    }
+
+    return in.fail() ? NULL : ast;
+}
@@ -4,6 +4,7 @@
 #include <vector>
 #include <string>
 
+#include "Arena.h"
 #include "AstRef.h"
 #include "AuxDB.h"
 #include "Hash.h"
@@ -15,6 +16,7 @@
 #include "Renaming.h"
 #include "Requirements.h"
 #include "Renaming.h"
+#include "Symbol.h"
 #include "SyntacticContext.h"
 
 #include "clang/AST/AST.h"
@@ -29,20 +31,63 @@ struct TU;
 typedef int SourceOffset;
 extern const SourceOffset BadOffset;
 
+// A line and column in the original source (the parts of a
+// clang::PresumedLoc that outlive the clang IR).
+class SourcePos
+{
+public:
+    SourcePos() : m_line(0), m_col(0) {}
+    SourcePos(unsigned line, unsigned col) : m_line(line), m_col(col) {}
+    SourcePos(const clang::PresumedLoc & loc)
+        : m_line(loc.isValid() ? loc.getLine() : 0)
+        , m_col(loc.isValid() ? loc.getColumn() : 0)
+    {}
+
+    bool isValid() const { return m_line != 0; }
+    unsigned getLine() const { return m_line; }
+    unsigned getColumn() const { return m_col; }
+private:
+    unsigned m_line;
+    unsigned m_col;
+};
+
+// How an Ast moves within its TU when text before it is replaced
+// (see Reparse.h). Counters, source offsets and rename table indices
+// each move by a constant; source positions on the line where the
+// replaced text ended (`from`) move to the line where the new text
+// ends (`to`), and those on later lines move by as many lines.
+struct AstShift
+{
+    AstShift() : counters(0), offsets(0), sites(0), from(), to() {}
+
+    long counters;
+    long offsets;
+    long sites;
+    SourcePos from;
+    SourcePos to;
+
+    AstRef apply(AstRef ref) const;
+    SourceOffset apply(SourceOffset offset) const;
+    SourcePos apply(SourcePos pos) const;
+};
+
+class FieldPlan;
+
 class Ast
 {
 public:
     // NOTE: the CompilerInstance is not used here; it is just
     //       a token used to assert "yes, the clang IR backing
     //       this Ast is still in memory".  In effect, these
-    //       methods can only be used during TU construction.
+    //       methods can only be used during TU construction,
+    //       since the IR is destroyed when the TU is detached.
     clang::Decl * asDecl(clang::CompilerInstance const&) const
-    { return m_decl; }
+    { return m_is_decl ? m_decl : NULL; }
     clang::Stmt * asStmt(clang::CompilerInstance const&) const
-    { return m_stmt; }
+    { return m_is_decl ? NULL : m_stmt; }
 
-    bool isDecl() const { return (m_decl != NULL); }
-    bool isStmt() const { return (m_stmt != NULL); }
+    bool isDecl() const { return m_is_decl; }
+    bool isStmt() const { return !m_is_decl; }
 
     // The source range for the statement itself, not including
     // any trailing semicolon.
@@ -73,7 +118,7 @@ public:
         return m_end_off - 1;
     }
 
-    const std::string & className() const
+    Symbol className() const
     { return m_class; }
 
     const std::vector<std::string> & declares() const
@@ -124,7 +169,7 @@ public:
     const Replacements & replacements() const
     { return m_replacements; }
 
-    std::string opcode() const
+    Symbol opcode() const
     { return m_opcode; }
 
     SyntacticContext syntacticContext() const
@@ -151,7 +196,7 @@ public:
     bool canHaveCompilationData() const
     { return m_can_have_compilation_data; }
 
-    std::string srcFilename() const;
+    const std::string & srcFilename() const;
 
     bool has_bytes() const;
 
@@ -176,35 +221,53 @@ public:
     { m_in_macro_expansion = yn; }
 
     bool isFunctionDecl() const
-    { return m_class == "Function" ||
-             m_class == "CXXMethod" ||
-             m_class == "CXXConstructor" ||
-             m_class == "CXXConversionDecl" ||
-             m_class == "CXXDestructor"; }
+    { return m_class == AstClass::Function ||
+             m_class == AstClass::CXXMethod ||
+             m_class == AstClass::CXXConstructor ||
+             m_class == AstClass::CXXConversionDecl ||
+             m_class == AstClass::CXXDestructor; }
 
     bool is_field_decl() const
     { return m_field_decl; }
 
-    const std::string & base_type() const
-    { return m_base_type; }
+    Symbol base_type() const
+    { return extras().base_type; }
 
     bool is_bit_field() const
     { return m_bit_field; }
 
     unsigned bit_field_width() const
-    { return m_bit_field_width; }
+    { return extras().bit_field_width; }
 
     unsigned long array_length() const
-    { return m_array_length; }
+    { return extras().array_length; }
 
-    clang::PresumedLoc begin_src_pos() const
+    SourcePos begin_src_pos() const
     { return m_begin_loc; }
 
-    clang::PresumedLoc end_src_pos() const
+    SourcePos end_src_pos() const
     { return m_end_loc; }
 
+    // An Ast's counter is its entry index in a pre-order walk of the
+    // TU, and its exit index is the counter of its last descendant
+    // (or its own counter, if it has none). The Asts in its subtree
+    // are exactly those whose counters lie between the two, so
+    // ancestry and subtree queries need not walk the tree.
+    AstCounter entry_index() const
+    { return m_counter.counter(); }
+
+    AstCounter exit_index() const
+    { return m_exit; }
+
+    void setExitIndex(AstCounter exit)
+    { m_exit = exit; }
+
+    // Is `ast` this Ast or one of its descendants?
     bool is_ancestor_of(AstRef ast) const;
 
+    // This Ast's descendants, in pre-order.
+    std::vector<AstRef> descendants() const;
+
     const AstRef & counter() const
     { return m_counter; }
 
@@ -212,7 +275,7 @@ public:
     { return m_parent; }
 
     AuxDBEntry &aux()
-    { return m_aux; }
+    { return extras().aux; }
 
     std::pair<AstRef, AstRef> stmt_range() const;
 
@@ -231,16 +294,24 @@ public:
     { return m_successors; }
 
     const std::vector<std::string> & annotations() const
-    { return m_annotations; }
+    { return extras().annotations; }
 
     const std::string & label_name() const
-      { return m_label_name; }
+      { return extras().label_name; }
 
     bool isMemberExpr() const
       { return m_is_member_expr; }
 
     picojson::value toJSON(const std::set<std::string> & keys,
                            bool include_aux) const;
+    picojson::value toJSON(const FieldPlan & plan, bool include_aux) const;
+
+    // Write the same object as toJSON to `out` in `syntax`, one field
+    // at a time, without building the whole object first.
+    void writeRecord(std::ostream & out,
+                     const RecordSyntax & syntax,
+                     const FieldPlan & plan,
+                     bool include_aux) const;
 
     Ast(clang::Stmt * _stmt,
         AstRef _counter,
@@ -284,8 +355,32 @@ public:
 
     static std::map<std::string, Ast::Field*> & ast_fields();
 
+    // An estimate of the memory used by this Ast: its own size, plus
+    // whatever its members have allocated on the heap.
+    size_t memoryUsage() const;
+
+    // Every identifier referenced by this Ast's free variables and
+    // functions, for use with BinaryWriter::setIdentifiers.
+    void collectIdentifiers(std::set<const clang::IdentifierInfo*> & ids) const;
+
+    // Serialize the cached traits of this Ast. An Ast that is read
+    // back has no clang IR or source ranges behind it; everything
+    // else (and so its JSON form) is the same as the original's.
+    void write(BinaryWriter & out) const;
+    static Ast * read(BinaryReader & in, Arena<Ast> & arena);
+
+    // Asts are moved (not copied) into a new arena when their TU is
+    // reparsed; see Reparse.h.
+    Ast(Ast && that) = default;
+
+    void relocate(const AstShift & shift);
+
 
 private:
+    friend class Arena<Ast>;
+
+    Ast();
+
     void update_range_offsets(clang::CompilerInstance * ci);
 
     void setFieldDeclProperties(clang::ASTContext * context,
@@ -296,63 +391,110 @@ private:
     template <typename T>
         static AstRef impl_create(T * clang_obj, Requirements & reqs);
 
-    clang::Stmt * m_stmt;
-    clang::Decl * m_decl;
+    // Traits that only a few kinds of Ast have, which are kept out of
+    // line to keep the common case small.
+    struct Extras
+    {
+        Extras() : bit_field_width(0), array_length(0) {}
+
+        // Properties for struct field decls
+        Symbol base_type;
+        unsigned bit_field_width;
+        unsigned long array_length;
+        // Properties for member exprs
+        std::string label_name;
+        std::vector<std::string> annotations;
+        // Additional class-specific fields
+        AuxDBEntry aux;
+    };
+
+    static const Extras s_no_extras;
+
+    const Extras & extras() const
+    { return m_extras ? *m_extras : s_no_extras; }
+
+    Extras & extras()
+    {
+        if (!m_extras)
+            m_extras.reset(new Extras());
+        return *m_extras;
+    }
+
+    // The hot scalar traits come first, so that walks over the tree
+    // (parents, offsets, contexts and flags) touch as few cache lines
+    // as possible. Asts are allocated next to each other from their
+    // TU's arena.
     AstRef m_counter;
     AstRef m_parent;
+    AstCounter m_exit;
+    SourceOffset m_norm_start_off, m_norm_end_off, m_start_off, m_end_off;
+    SyntacticContext m_syn_ctx;
+    bool m_is_decl : 1;
+    bool m_guard : 1;
+    bool m_full_stmt : 1;
+    bool m_in_macro_expansion : 1;
+    bool m_can_have_compilation_data : 1;
+    bool m_field_decl : 1;
+    bool m_bit_field : 1;
+    bool m_is_member_expr : 1;
+    PTNode m_scope_pos;
+    Hash m_expr_type;
+    Symbol m_class;
+    Symbol m_opcode;
+
+    // The clang IR behind this Ast, which is only valid while the TU
+    // is being built; m_is_decl says which member is live.
+    union {
+        clang::Stmt * m_stmt;
+        clang::Decl * m_decl;
+    };
+
     std::vector<AstRef> m_children;
     std::vector<AstRef> m_successors;
 
-    // These are all traits of the Stmt/Decl that do not seem
-    // to be recoverable after the ActionFactory has run.
-    // We cache them here; if we can figure out how to
-    // get clang to keep the appropriate structures in
-    // memory, then we can avoid the caching entirely.
-    //
-    // To catch things like this, load two or more files
-    // into clang-mutate at once and try to process ASTs
-    // in the first file. For the last file processed,
-    // the relevant clang data structures stay alive,
-    // making it harder to notice bugs where we try to
-    // access vanished data.
+    // These are all traits of the Stmt/Decl which are needed
+    // after the TU has been built, when the clang data structures
+    // behind it have been destroyed (see TU::detach).
     //
-    std::string m_class;
+    // Unlike the Ast itself, these containers (and those in Extras)
+    // allocate from the heap, and ~Ast frees them one at a time. They
+    // are handed out and taken in as plain standard containers by
+    // their accessors, which the rest of clang-mutate copies, merges
+    // and compares against its own; backing them with the arena would
+    // mean a stateful allocator type (there is no std::pmr in the
+    // language version LLVM builds us with) in every one of those
+    // signatures. The memory op reports what they cost as
+    // payload_bytes.
     clang::SourceRange m_range;
     clang::SourceRange m_normalized_range;
-    clang::PresumedLoc m_begin_loc;
-    clang::PresumedLoc m_end_loc;
+    SourcePos m_begin_loc;
+    SourcePos m_end_loc;
     std::vector<std::string> m_declares;
-    bool m_guard;
     std::vector<Hash> m_types;
-    Hash m_expr_type;
     std::set<std::string> m_includes;
-    PTNode m_scope_pos;
     std::set<Hash> m_macros;
     std::set<VariableInfo> m_free_vars;
     std::set<FunctionInfo> m_free_funs;
-    std::string m_opcode;
-    bool m_full_stmt;
-    bool m_in_macro_expansion;
-    SyntacticContext m_syn_ctx;
-    bool m_can_have_compilation_data;
     Replacements m_replacements;
-    // Additional class-specific fields
-    AuxDBEntry m_aux;
-
-    // Properties for struct field decls
-    bool m_field_decl;
-    std::string m_base_type;
-    bool m_bit_field;
-    unsigned m_bit_field_width;
-    unsigned long m_array_length;
-    // Properties for member exprs
-    std::string m_label_name;
-    bool m_is_member_expr;
 
-    SourceOffset m_norm_start_off, m_norm_end_off, m_start_off, m_end_off;
+    std::unique_ptr<Extras> m_extras;
+};
 
-    std::vector<std::string> m_annotations;
+// The fields selected by a fields= list (every field, if the list is
+// empty), looked up once per op so that serializing each Ast runs only
+// the selected fields. They are kept in name order, which is the order
+// of the keys in an Ast's JSON object.
+class FieldPlan
+{
+public:
+    FieldPlan(const std::set<std::string> & keys);
 
+    typedef std::vector<std::pair<std::string, Ast::Field*> > Fields;
+
+    Fields::const_iterator begin() const { return m_fields.begin(); }
+    Fields::const_iterator end() const { return m_fields.end(); }
+private:
+    Fields m_fields;
 };
 
 } // namespace clang_mutate
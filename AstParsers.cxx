@@ -16,6 +16,9 @@ struct p_text;
 // Parse a variable identifier.
 typedef fmap<Cons<char>, sequence_<chr<'$'>, word>> variable;
 
+// Parse a snapshot name.
+typedef fmap<Cons<char>, sequence_<chr<'@'>, word>> snapshot_name;
+
 struct p_tu
 {
     constexpr static bool is_productive = true;
@@ -31,7 +34,7 @@ struct p_tu
             ans.ok = false;
             return ans;
         }
-        if (TUs.find(n.result) == TUs.end()) {
+        if (!TUs.contains(n.result)) {
             std::ostringstream oss;
             oss << "No translation unit with id " << n.result
                 << " is loaded." << std::endl
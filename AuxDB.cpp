@@ -7,6 +7,25 @@ AuxDB::AuxDatabase AuxDB::aux_db;
 picojson::value AuxDBEntry::toJSON() const
 { return to_json(m_obj); }
 
+void AuxDBEntry::write(BinaryWriter & out) const
+{
+    out.put(uint64_t(m_obj.size()));
+    for (auto & entry : m_obj) {
+        out.put(entry.first);
+        out.put(entry.second.serialize());
+    }
+}
+
+void AuxDBEntry::read(BinaryReader & in)
+{
+    m_obj.clear();
+    size_t n = in.get_uint();
+    for (size_t i = 0; i < n && !in.fail(); ++i) {
+        std::string key = in.get_string();
+        picojson::parse(m_obj[key], in.get_string());
+    }
+}
+
 picojson::array AuxDB::toJSON()
 {
     picojson::array ans;
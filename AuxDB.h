@@ -2,6 +2,7 @@
 #define AUX_DB_ENTRY_H
 
 #include "Json.h"
+#include "Serialization.h"
 
 #include <map>
 #include <string>
@@ -15,6 +16,8 @@ public:
 
     picojson::value toJSON() const;
 
+    bool empty() const { return m_obj.empty(); }
+
     template <typename T>
     AuxDBEntry& set(const std::string & key,
                     const T & value)
@@ -22,6 +25,10 @@ public:
         m_obj[key] = to_json(value);
         return *this;
     }
+
+    // Values are stored as their JSON text.
+    void write(BinaryWriter & out) const;
+    void read(BinaryReader & in);
     
 private:
     std::map<std::string, picojson::value> m_obj;
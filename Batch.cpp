@@ -0,0 +1,203 @@
+#include "Batch.h"
+
+#include "Fingerprint.h"
+#include "Rewrite.h"
+#include "TU.h"
+#include "Utils.h"
+
+#include <fstream>
+#include <map>
+#include <vector>
+
+namespace clang_mutate {
+
+unsigned batch_threads = 1;
+bool batch_diffs = false;
+
+namespace {
+
+const size_t NotDuplicate = (size_t) -1;
+
+struct Variant
+{
+    Variant() : op(), output(), error(), buffer(), fingerprint(),
+                duplicate_of(NotDuplicate) {}
+    RewritingOpPtr op;
+    std::string output;
+    std::string error;
+    // What the variant's edits make of the TU, and the earlier variant
+    // (if any) which they make the same text of.
+    EditBuffer buffer;
+    Fingerprint fingerprint;
+    size_t duplicate_of;
+};
+
+// Build the edits described by a manifest entry into `variant`, or
+// say why the entry is malformed in `variant.error`.
+void parseVariant(TURef tu, const picojson::value & entry, Variant & variant)
+{
+    std::string & error = variant.error;
+    if (!entry.is<picojson::object>()) {
+        error = "not a JSON object";
+        return;
+    }
+    const picojson::object & fields = entry.get<picojson::object>();
+
+    auto get_string = [&](const char * key, std::string & value) {
+        auto it = fields.find(key);
+        if (it == fields.end() || !it->second.is<std::string>()) {
+            error = std::string("missing string ") + key;
+            return false;
+        }
+        value = it->second.get<std::string>();
+        return true;
+    };
+    auto get_ast = [&](const char * key, AstRef & ast) {
+        auto it = fields.find(key);
+        if (it == fields.end() || !it->second.is<int64_t>()) {
+            error = std::string("missing AST counter ") + key;
+            return false;
+        }
+        int64_t counter = it->second.get<int64_t>();
+        if (counter < 1 || counter > (int64_t) TUs[tu]->asts.size()) {
+            error = "no AST " + it->second.to_str();
+            return false;
+        }
+        ast = AstRef(tu, counter);
+        return true;
+    };
+
+    if (fields.count("output") && !get_string("output", variant.output))
+        return;
+
+    std::string op, value1;
+    AstRef stmt1, stmt2;
+    if (!get_string("op", op))
+        return;
+    if (op == "cut") {
+        if (get_ast("stmt1", stmt1))
+            variant.op = setText(stmt1, "");
+    }
+    else if (op == "set") {
+        if (get_ast("stmt1", stmt1) && get_string("value1", value1))
+            variant.op = setText(stmt1, value1);
+    }
+    else if (op == "insert") {
+        if (get_ast("stmt1", stmt1) && get_ast("stmt2", stmt2)) {
+            variant.op = chain({ getTextAs   (stmt1, "$stmt")
+                               , insertBefore(stmt2, "$stmt") });
+        }
+    }
+    else if (op == "insert-value") {
+        if (get_ast("stmt1", stmt1) && get_string("value1", value1))
+            variant.op = insertBefore(stmt1, value1);
+    }
+    else if (op == "swap") {
+        if (get_ast("stmt1", stmt1) && get_ast("stmt2", stmt2)) {
+            variant.op = chain({ getTextAs (stmt1, "$swap1")
+                               , getTextAs (stmt2, "$swap2")
+                               , setText   (stmt1, "$swap2")
+                               , setText   (stmt2, "$swap1") });
+        }
+    }
+    else {
+        error = "unknown op " + op;
+    }
+}
+
+} // end namespace
+
+bool runBatch(TURef tu,
+              const std::string & path,
+              std::ostream & out,
+              std::string & error)
+{
+    std::ifstream in(path);
+    if (!in) {
+        error = "could not read " + path;
+        return false;
+    }
+
+    // Build and apply every variant's edits here: RewritingOps are
+    // reference counted (and deleted) without locking, so the worker
+    // threads only render the results.
+    std::vector<Variant> variants;
+    std::string line;
+    while (std::getline(in, line)) {
+        if (Utils::trim(line).empty())
+            continue;
+        variants.push_back(Variant());
+        picojson::value entry;
+        variants.back().error = picojson::parse(entry, line);
+        if (variants.back().error.empty())
+            parseVariant(tu, entry, variants.back());
+    }
+
+    // Set aside each variant whose text is the same as an earlier
+    // one's, going by their fingerprints, so that it is not rendered.
+    TU & unit = *TUs[tu];
+    const std::string & source = unit.source;
+    const SourceHashes & hashes = sourceHashes(unit);
+    std::map<Fingerprint, size_t> seen;
+    for (size_t i = 0; i < variants.size(); ++i) {
+        Variant & variant = variants[i];
+        if (!variant.error.empty())
+            continue;
+        RewriterState state;
+        if (!variant.op->run(state)) {
+            variant.error = state.message;
+            continue;
+        }
+        variant.buffer = state.rewriter(tu);
+        variant.fingerprint = variant.buffer.fingerprint(source, hashes);
+        auto first = seen.insert(std::make_pair(variant.fingerprint, i));
+        if (!first.second)
+            variant.duplicate_of = first.first->second;
+    }
+
+    std::string filename = unit.filename.str();
+    serializeRecords(
+        out, variants.size(),
+        [&](std::ostream & o, size_t i) {
+            const Variant & variant = variants[i];
+            picojson::object header;
+            header["variant"] = to_json(i);
+            if (variant.duplicate_of != NotDuplicate) {
+                header["duplicate"] = to_json(variant.duplicate_of);
+                o << picojson::value(header) << "\n";
+                return;
+            }
+
+            std::string failure = variant.error;
+            std::string text;
+            if (failure.empty()) {
+                text = batch_diffs ? variant.buffer.diff(source, filename)
+                                   : variant.buffer.preview(source);
+            }
+            if (failure.empty() && !variant.output.empty()) {
+                std::ofstream file(variant.output,
+                                   std::ios::binary | std::ios::trunc);
+                file << text;
+                file.close();
+                if (!file)
+                    failure = "could not write " + variant.output;
+            }
+
+            if (!failure.empty()) {
+                header["error"] = to_json(failure);
+                o << picojson::value(header) << "\n";
+                return;
+            }
+            header["bytes"] = to_json(text.size());
+            header["fingerprint"] = to_json(variant.fingerprint.str());
+            if (!variant.output.empty())
+                header["output"] = to_json(variant.output);
+            o << picojson::value(header) << "\n";
+            if (variant.output.empty())
+                o << text;
+        },
+        batch_threads, 1);
+    return true;
+}
+
+} // end namespace clang_mutate
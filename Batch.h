@@ -0,0 +1,59 @@
+#ifndef CLANG_MUTATE_BATCH_H
+#define CLANG_MUTATE_BATCH_H
+
+// Batches of single-mutation variants of one TU, so that a TU parsed
+// once can be mutated many times over. A manifest is a JSON Lines
+// file, with one variant per (non-blank) line:
+//
+//   {"op": "cut",          "stmt1": N}
+//   {"op": "set",          "stmt1": N, "value1": TEXT}
+//   {"op": "insert",       "stmt1": N, "stmt2": M}
+//   {"op": "insert-value", "stmt1": N, "value1": TEXT}
+//   {"op": "swap",         "stmt1": N, "stmt2": M}
+//
+// which mean the same as the command-line options of those names. A
+// variant may also give an "output" path, to which its text is
+// written. Each variant is applied to an EditBuffer of its own, and
+// the results are reported in manifest order as a framed stream: for
+// the i'th variant (counting from 0), a JSON line
+//
+//   {"variant": i, "bytes": B, "fingerprint": F}
+//       followed by B bytes of text, or with "output": PATH if the
+//       text went to PATH instead
+//   {"variant": i, "duplicate": j}   if the text is that of variant j
+//   {"variant": i, "error": MESSAGE} if the variant failed
+//
+// where F is the fingerprint of the text (see Fingerprint.h). A
+// variant whose fingerprint is that of an earlier variant is not
+// rendered (or written to its output) at all.
+//
+// If batch_diffs is set, a variant's text is a unified diff from the
+// TU's source (see Diff.h) rather than the whole modified source.
+// Variants are rendered on up to batch_threads threads at a time,
+// which only read the TU.
+
+#include "AstRef.h"
+
+#include <ostream>
+#include <string>
+
+namespace clang_mutate {
+
+// The number of threads with which to apply the variants of a batch.
+extern unsigned batch_threads;
+
+// Whether to give each variant as a diff rather than as its text.
+extern bool batch_diffs;
+
+// Apply the variants listed in the manifest at `path` to `tu`, writing
+// the framed results to `out`. Returns false, saying why in `error`,
+// only if the manifest could not be read; a variant which fails is
+// reported in the stream.
+bool runBatch(TURef tu,
+              const std::string & path,
+              std::ostream & out,
+              std::string & error);
+
+} // end namespace clang_mutate
+
+#endif
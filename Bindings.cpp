@@ -39,6 +39,24 @@ bool BindingCtx::is_bound(const std::string & name) const
   return lookup(name).first != NULL;
 }
 
+void BindingCtx::merge(const BindingCtx & inner)
+{
+  for (auto & binding : inner.ctx) {
+    // std::stack has no iterators; unwind a copy to recover the
+    // bindings in push order.
+    IdStack stack = binding.second;
+    std::vector<std::pair<Id, Hash> > pushed;
+    while (!stack.empty()) {
+      pushed.push_back(stack.top());
+      stack.pop();
+    }
+    IdStack & bindings = ctx[binding.first];
+    for (auto it = pushed.rbegin(); it != pushed.rend(); ++it)
+      bindings.push(*it);
+  }
+  types.insert(types.end(), inner.types.begin(), inner.types.end());
+}
+
 bool GetBindingCtx::TraverseVarDecl(VarDecl * decl)
 {
   std::string name = decl->getQualifiedNameAsString();
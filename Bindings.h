@@ -42,6 +42,10 @@ public:
   std::pair<Id,Hash> lookup(const std::string & name) const;
   bool is_bound(const std::string & name) const;
 
+  // Append the bindings made in an inner context, in the order
+  // they were made, as if they had been pushed onto this one.
+  void merge(const BindingCtx & inner);
+
   std::vector<Hash> required_types() const;
   
 private:
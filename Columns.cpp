@@ -0,0 +1,232 @@
+#include "Columns.h"
+
+#include <algorithm>
+#include <fstream>
+#include <map>
+
+namespace clang_mutate {
+
+const char ColumnsMagic[8] = { 'C', 'M', 'C', 'O', 'L', 'S', '\0', '\0' };
+const uint64_t ColumnsVersion = 1;
+
+namespace {
+
+// The values of one field, gathered in counter order. The column
+// starts out typed by its first value, and falls back to JSON text as
+// soon as a value of any other type turns up.
+class Column
+{
+public:
+    Column(const std::string & _name)
+        : name(_name), type(0), present(), words(1, 0), blob()
+    {}
+
+    void add_absent()
+    {
+        present.push_back(0);
+        if (type == Column_Int || type == Column_Bool || type == 0)
+            words.push_back(0);
+        else
+            words.push_back(blob.size());
+    }
+
+    void add(const picojson::value & value)
+    {
+        ColumnType value_type =
+            value.is<int64_t>()     ? Column_Int :
+            value.is<bool>()        ? Column_Bool :
+            value.is<std::string>() ? Column_String :
+                                      Column_Json;
+        if (type == 0)
+            start(value_type);
+        else if (type != value_type && type != Column_Json)
+            to_json();
+
+        present.push_back(1);
+        switch (type) {
+        case Column_Int:
+            words.push_back(uint64_t(value.get<int64_t>()));
+            break;
+        case Column_Bool:
+            words.push_back(value.get<bool>() ? 1 : 0);
+            break;
+        case Column_String:
+            blob += value.get<std::string>();
+            words.push_back(blob.size());
+            break;
+        default:
+            blob += value.serialize();
+            words.push_back(blob.size());
+            break;
+        }
+    }
+
+    // A column with no values at all is an empty JSON column.
+    ColumnType final_type() const
+    { return type == 0 ? Column_Json : ColumnType(type); }
+
+    // The number of words in the values section.
+    size_t values_size() const
+    {
+        ColumnType t = final_type();
+        return (t == Column_Int || t == Column_Bool)
+            ? words.size() - 1
+            : words.size();
+    }
+
+    const uint64_t * values() const
+    {
+        ColumnType t = final_type();
+        return (t == Column_Int || t == Column_Bool)
+            ? words.data() + 1
+            : words.data();
+    }
+
+    std::string name;
+    int type;
+    std::vector<char> present;
+    // For Int and Bool columns, a dummy word and then the values; for
+    // the others, the offsets of the values in the blob. Either way
+    // there is one word more than there are rows, so that a column
+    // can change representation in place.
+    std::vector<uint64_t> words;
+    std::string blob;
+
+private:
+    void start(ColumnType value_type)
+    {
+        type = value_type;
+        if (type == Column_String || type == Column_Json)
+            std::fill(words.begin(), words.end(), 0);
+    }
+
+    // Rewrite the values gathered so far as JSON text.
+    void to_json()
+    {
+        std::string old_blob;
+        old_blob.swap(blob);
+        std::vector<uint64_t> old_words(words);
+        for (size_t row = 0; row < present.size(); ++row) {
+            if (present[row]) {
+                picojson::value value;
+                if (type == Column_Int)
+                    value = picojson::value(int64_t(old_words[row + 1]));
+                else if (type == Column_Bool)
+                    value = picojson::value(old_words[row + 1] != 0);
+                else
+                    value = picojson::value(old_blob.substr(
+                        old_words[row], old_words[row + 1] - old_words[row]));
+                blob += value.serialize();
+            }
+            words[row + 1] = blob.size();
+        }
+        words[0] = 0;
+        type = Column_Json;
+    }
+};
+
+size_t padded(size_t n)
+{ return (n + 7) & ~size_t(7); }
+
+void put_word(std::ostream & out, uint64_t n)
+{
+    char bytes[8];
+    for (int i = 0; i < 8; ++i)
+        bytes[i] = char(n >> (8 * i));
+    out.write(bytes, 8);
+}
+
+void put_padded(std::ostream & out, const char * data, size_t size)
+{
+    static const char zeroes[8] = { 0 };
+    out.write(data, size);
+    out.write(zeroes, padded(size) - size);
+}
+
+} // end namespace
+
+bool writeColumns(TU & tu,
+                  const std::vector<std::string> & fields,
+                  const std::string & path,
+                  size_t & bytes,
+                  std::string & error)
+{
+    std::map<std::string, Ast::Field*> & all_fields = Ast::ast_fields();
+    std::vector<std::pair<Ast::Field*, Column> > columns;
+    if (fields.empty()) {
+        for (auto & field : all_fields)
+            columns.push_back(std::make_pair(field.second,
+                                             Column(field.first)));
+    }
+    for (auto & name : fields) {
+        auto it = all_fields.find(name);
+        if (it == all_fields.end()) {
+            error = "unknown field " + name;
+            return false;
+        }
+        columns.push_back(std::make_pair(it->second, Column(name)));
+    }
+
+    for (auto & ast : tu.asts) {
+        for (auto & column : columns) {
+            if (column.first->has_field(tu, *ast))
+                column.second.add(column.first->to_json(tu, *ast));
+            else
+                column.second.add_absent();
+        }
+    }
+
+    // Lay out the file: the header and directory, then each column's
+    // name and sections in turn.
+    size_t rows = tu.asts.size();
+    const size_t directory_words = 7;
+    size_t offset = 8 + 3 * 8 + columns.size() * directory_words * 8;
+    std::vector<std::vector<uint64_t> > directory;
+    for (auto & entry : columns) {
+        Column & column = entry.second;
+        std::vector<uint64_t> dir(directory_words);
+        dir[0] = offset;
+        dir[1] = column.name.size();
+        offset += padded(column.name.size());
+        dir[2] = column.final_type();
+        dir[3] = offset;
+        offset += padded(rows);
+        dir[4] = offset;
+        offset += 8 * column.values_size();
+        dir[5] = offset;
+        dir[6] = column.blob.size();
+        offset += padded(column.blob.size());
+        directory.push_back(dir);
+    }
+
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    if (!out) {
+        error = "could not open " + path + " for writing";
+        return false;
+    }
+    out.write(ColumnsMagic, 8);
+    put_word(out, ColumnsVersion);
+    put_word(out, rows);
+    put_word(out, columns.size());
+    for (auto & dir : directory)
+        for (auto word : dir)
+            put_word(out, word);
+    for (auto & entry : columns) {
+        Column & column = entry.second;
+        put_padded(out, column.name.data(), column.name.size());
+        put_padded(out, column.present.data(), column.present.size());
+        const uint64_t * values = column.values();
+        for (size_t i = 0; i < column.values_size(); ++i)
+            put_word(out, values[i]);
+        put_padded(out, column.blob.data(), column.blob.size());
+    }
+    out.close();
+    if (!out) {
+        error = "could not write " + path;
+        return false;
+    }
+    bytes = offset;
+    return true;
+}
+
+} // end namespace clang_mutate
@@ -0,0 +1,60 @@
+#ifndef CLANG_MUTATE_COLUMNS_H
+#define CLANG_MUTATE_COLUMNS_H
+
+// A columnar export of AST fields, for scanning a few fields across
+// many ASTs without parsing a JSON object per AST. Each field is
+// written as one contiguous column, in a single file which may be
+// memory-mapped: selecting a field is a seek to its column, and
+// scanning it is a sequential read.
+//
+// All integers are little-endian 64-bit words, and every section
+// starts on an 8-byte boundary. The file holds:
+//
+//   header      ColumnsMagic (8 bytes), version, rows, columns
+//   directory   for each column: name_offset, name_length, type,
+//               present_offset, values_offset, blob_offset,
+//               blob_length
+//   sections    for each column, its name, then its present,
+//               values and blob sections
+//
+// Row i is the AST with counter i + 1. A column's `present` section
+// holds one byte per row, which is 1 if that AST has the field. Its
+// values section depends on its type:
+//
+//   Column_Int, Column_Bool   one word per row (0 where absent)
+//   Column_String             rows + 1 word offsets into the blob;
+//                             row i is blob[offsets[i], offsets[i+1])
+//   Column_Json               as Column_String, where each value is
+//                             the JSON text of the field
+//
+// A column holds integers (or booleans, or strings) if every AST
+// which has the field gives a value of that type, and JSON otherwise.
+
+#include "TU.h"
+
+#include <string>
+#include <vector>
+
+namespace clang_mutate {
+
+extern const char ColumnsMagic[8];
+extern const uint64_t ColumnsVersion;
+
+enum ColumnType { Column_Int = 1
+                , Column_Bool
+                , Column_String
+                , Column_Json
+};
+
+// Write the columns for `fields` (every field, if empty) of the Asts
+// of `tu` to `path`. On failure, returns false and says why in
+// `error`; otherwise `bytes` is the size of the file written.
+bool writeColumns(TU & tu,
+                  const std::vector<std::string> & fields,
+                  const std::string & path,
+                  size_t & bytes,
+                  std::string & error);
+
+} // end namespace clang_mutate
+
+#endif
@@ -0,0 +1,309 @@
+#include "Diff.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <sstream>
+
+namespace clang_mutate {
+
+namespace {
+
+const char NoNewline[] = "\\ No newline at end of file\n";
+
+// The lines of some text, as the offsets at which they start.
+class LineIndex
+{
+public:
+    LineIndex(const std::string & text) : m_size(text.size()), m_starts()
+    {
+        if (text.empty())
+            return;
+        m_starts.push_back(0);
+        for (size_t i = text.find('\n');
+             i != std::string::npos && i + 1 < text.size();
+             i = text.find('\n', i + 1))
+        {
+            m_starts.push_back(i + 1);
+        }
+    }
+
+    int lines() const { return m_starts.size(); }
+
+    // The line containing `offset`, or the last line if `offset` is
+    // the end of the text.
+    int line_of(SourceOffset offset) const
+    {
+        auto it = std::upper_bound(m_starts.begin(), m_starts.end(),
+                                   (size_t) offset);
+        return std::max(0, int(it - m_starts.begin()) - 1);
+    }
+
+    SourceOffset begin(int line) const
+    { return line < lines() ? m_starts[line] : m_size; }
+
+    SourceOffset end(int line) const
+    { return begin(line + 1); }
+
+private:
+    size_t m_size;
+    std::vector<size_t> m_starts;
+};
+
+// A run of whole lines of the source, and the spans which change it.
+struct Change
+{
+    int first, last;
+    std::vector<const EditSpan *> spans;
+};
+
+// Write each line of `text` prefixed by `mark`, returning how many
+// lines there were.
+int writeLines(std::ostream & out, char mark, const std::string & text)
+{
+    int count = 0;
+    size_t idx = 0;
+    while (idx < text.size()) {
+        size_t stop = text.find('\n', idx);
+        out << mark;
+        if (stop == std::string::npos) {
+            out.write(text.data() + idx, text.size() - idx);
+            out << "\n" << NoNewline;
+            idx = text.size();
+        }
+        else {
+            out.write(text.data() + idx, stop + 1 - idx);
+            idx = stop + 1;
+        }
+        ++count;
+    }
+    return count;
+}
+
+// The start line of a range in a hunk header: one-based, or the line
+// before the range if it is empty.
+int hunkStart(int first, int count)
+{ return count == 0 ? first : first + 1; }
+
+} // end namespace
+
+std::string unifiedDiff(const std::string & source,
+                        const std::vector<EditSpan> & spans,
+                        const std::string & path,
+                        unsigned context)
+{
+    if (spans.empty())
+        return "";
+
+    LineIndex lines(source);
+    SourceOffset end = source.size();
+
+    // Widen each span to the lines it touches, merging spans which
+    // touch the same lines.
+    std::vector<Change> changes;
+    for (auto & span : spans) {
+        SourceOffset begin = std::min(span.begin, end);
+        int first = lines.line_of(begin);
+        int last = lines.lines() == 0
+            ? -1
+            : lines.line_of(std::min(std::max(span.end, begin), end));
+        // (An empty source has no lines, and every span touches its
+        // one empty run of them.)
+        if (!changes.empty()
+            && first <= std::max(changes.back().first, changes.back().last))
+        {
+            changes.back().last = std::max(changes.back().last, last);
+        }
+        else {
+            changes.push_back(Change());
+            changes.back().first = first;
+            changes.back().last = last;
+        }
+        changes.back().spans.push_back(&span);
+    }
+
+    std::ostringstream out;
+    out << "--- " << path << "\n"
+        << "+++ " << path << "\n";
+
+    int shift = 0;
+    for (size_t i = 0; i < changes.size(); ) {
+        // Changes which are close enough to share their context go in
+        // one hunk.
+        size_t j = i + 1;
+        while (j < changes.size()
+               && changes[j].first - changes[j - 1].last - 1
+                  <= 2 * (int) context)
+        {
+            ++j;
+        }
+        int first = std::max(0, changes[i].first - (int) context);
+        int last = std::min(lines.lines() - 1,
+                            changes[j - 1].last + (int) context);
+
+        std::ostringstream body;
+        int added = 0;
+        int line = first;
+        for (size_t k = i; k < j; ++k) {
+            const Change & change = changes[k];
+            for (; line < change.first; ++line) {
+                writeLines(body, ' ',
+                           source.substr(lines.begin(line),
+                                         lines.end(line) - lines.begin(line)));
+                ++added;
+            }
+
+            SourceOffset from = lines.begin(change.first);
+            SourceOffset to = lines.end(change.last);
+            std::string modified;
+            SourceOffset idx = from;
+            for (const EditSpan * span : change.spans) {
+                SourceOffset stop = std::min(span->begin, end);
+                if (idx < stop)
+                    modified.append(source, idx, stop - idx);
+                modified += span->text;
+                idx = std::max(idx, std::min(span->end, end));
+            }
+            if (idx < to)
+                modified.append(source, idx, to - idx);
+
+            writeLines(body, '-', source.substr(from, to - from));
+            added += writeLines(body, '+', modified);
+            line = change.last + 1;
+        }
+        for (; line <= last; ++line) {
+            writeLines(body, ' ',
+                       source.substr(lines.begin(line),
+                                     lines.end(line) - lines.begin(line)));
+            ++added;
+        }
+
+        int old_count = last - first + 1;
+        out << "@@ -" << hunkStart(first, old_count) << "," << old_count
+            << " +" << hunkStart(first + shift, added) << "," << added
+            << " @@\n"
+            << body.str();
+        shift += added - old_count;
+        i = j;
+    }
+    return out.str();
+}
+
+bool applyUnifiedDiff(const std::string & source,
+                      const std::string & diff,
+                      std::string & result,
+                      std::string & error)
+{
+    LineIndex lines(source);
+    auto source_line = [&](int line) {
+        return source.substr(lines.begin(line),
+                             lines.end(line) - lines.begin(line));
+    };
+
+    // The lines of the diff, each with its newline (if any).
+    std::vector<std::string> patch;
+    for (size_t idx = 0; idx < diff.size(); ) {
+        size_t stop = diff.find('\n', idx);
+        stop = stop == std::string::npos ? diff.size() : stop + 1;
+        patch.push_back(diff.substr(idx, stop - idx));
+        idx = stop;
+    }
+
+    result.clear();
+    int line = 0;
+    int hunk = 0;
+    size_t i = 0;
+    while (i < patch.size()) {
+        if (patch[i].compare(0, 3, "@@ ") != 0) {
+            ++i;
+            continue;
+        }
+        ++hunk;
+        std::ostringstream where;
+        where << "hunk " << hunk;
+
+        const char * header = patch[i].c_str() + 3;
+        char * rest;
+        if (*header != '-') {
+            error = "malformed header for " + where.str();
+            return false;
+        }
+        long start = strtol(header + 1, &rest, 10);
+        long count = 1;
+        if (*rest == ',')
+            count = strtol(rest + 1, &rest, 10);
+        if (rest[0] != ' ' || rest[1] != '+') {
+            error = "malformed header for " + where.str();
+            return false;
+        }
+        long new_count = 1;
+        strtol(rest + 2, &rest, 10);
+        if (*rest == ',')
+            new_count = strtol(rest + 1, &rest, 10);
+        int first = count == 0 ? start : start - 1;
+        if (first < line || first > lines.lines()) {
+            error = where.str() + " does not apply";
+            return false;
+        }
+        ++i;
+
+        for (; line < first; ++line)
+            result += source_line(line);
+
+        // Check each context or removed line of the hunk against the
+        // source, and copy each context or added line to the result,
+        // without its newline if the next line says it had none. The
+        // hunk ends when it has as many lines as its header says; any
+        // other line before then (such as a context line which has
+        // lost its leading space), or a hunk line after it, means the
+        // diff is damaged.
+        long old_left = count;
+        long new_left = new_count;
+        while (old_left > 0 || new_left > 0) {
+            char mark = i < patch.size() && !patch[i].empty()
+                ? patch[i][0]
+                : '\0';
+            if ((mark != ' ' && mark != '-' && mark != '+')
+                || (mark != '+' && old_left == 0)
+                || (mark != '-' && new_left == 0))
+            {
+                error = where.str() + " does not match its line counts";
+                return false;
+            }
+            if (mark != '+')
+                --old_left;
+            if (mark != '-')
+                --new_left;
+            std::string text = patch[i].substr(1);
+            ++i;
+            if (i < patch.size() && patch[i].compare(0, 1, "\\") == 0) {
+                if (!text.empty() && text[text.size() - 1] == '\n')
+                    text.erase(text.size() - 1);
+                ++i;
+            }
+            if (mark != '+') {
+                if (line >= lines.lines() || source_line(line) != text) {
+                    error = where.str() + " does not apply";
+                    return false;
+                }
+                ++line;
+            }
+            if (mark != '-')
+                result += text;
+        }
+        if (i < patch.size()
+            && (patch[i].compare(0, 1, " ") == 0
+                || (patch[i].compare(0, 1, "-") == 0
+                    && patch[i].compare(0, 4, "--- ") != 0)
+                || (patch[i].compare(0, 1, "+") == 0
+                    && patch[i].compare(0, 4, "+++ ") != 0)))
+        {
+            error = where.str() + " does not match its line counts";
+            return false;
+        }
+    }
+    for (; line < lines.lines(); ++line)
+        result += source_line(line);
+    return true;
+}
+
+} // end namespace clang_mutate
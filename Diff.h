@@ -0,0 +1,35 @@
+#ifndef CLANG_MUTATE_DIFF_H
+#define CLANG_MUTATE_DIFF_H
+
+// Unified diffs between a TU's source and its modified text. A diff
+// is written from the spans of an EditBuffer (see EditBuffer::spans),
+// so only the lines around each edit are ever looked at, rather than
+// the whole modified text.
+
+#include "EditBuffer.h"
+
+#include <string>
+#include <vector>
+
+namespace clang_mutate {
+
+// The unified diff which turns `source` into the text that the edits
+// `spans` make of it, with `context` lines of context around each
+// change, and `path` as the name of both files. Empty if `spans` make
+// no change.
+std::string unifiedDiff(const std::string & source,
+                        const std::vector<EditSpan> & spans,
+                        const std::string & path,
+                        unsigned context = 3);
+
+// Apply the unified diff `diff` (of a single file) to `source`,
+// putting the patched text in `result`. On failure, returns false and
+// says why in `error`.
+bool applyUnifiedDiff(const std::string & source,
+                      const std::string & diff,
+                      std::string & result,
+                      std::string & error);
+
+} // end namespace clang_mutate
+
+#endif
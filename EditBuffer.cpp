@@ -1,9 +1,11 @@
 #include "EditBuffer.h"
 
+#include "Diff.h"
+#include "Fingerprint.h"
 #include "TU.h"
 
+#include <algorithm>
 #include <map>
-#include <sstream>
 
 using namespace clang_mutate;
 
@@ -14,21 +16,20 @@ struct LinearEdit
     size_t advance_by;
 };
 
-
-std::string EditBuffer::preview(const std::string & source) const
+// Gather the linearized edits to perform on the buffer, and (if
+// `targets` is not NULL) the edits they come from.
+static void linearize(const std::map<AstRef, Edit> & edits,
+                      std::map<SourceOffset, LinearEdit> & linear_edits,
+                      std::vector<EditTarget> * targets)
 {
-    std::ostringstream oss;
-
-    std::map<SourceOffset, LinearEdit> linear_edits;
-
     AstRef skipTo = NoAst;
-    
-    // Gather the linearized edits to perform on the buffer.
+
     for (auto & e : edits) {
         AstRef ast  = e.first;
         Edit const& edit = e.second;
 
-        if (skipTo != NoAst && (skipTo->is_ancestor_of(ast) || ast < skipTo))
+        // Skip edits within (or before the end of) a replaced subtree.
+        if (skipTo != NoAst && ast.counter() <= skipTo->exit_index())
             continue;
         skipTo = NoAst;
 
@@ -37,6 +38,8 @@ std::string EditBuffer::preview(const std::string & source) const
         SourceOffset end = endAst->final_normalized_offset();
         if (start == BadOffset || end == BadOffset)
             continue;
+        if (targets != NULL)
+            targets->push_back({ ast, endAst, edit.skipTo != NoAst });
         start += edit.preAdjust;
         end += 1 + edit.postAdjust;
         LinearEdit & ledit = linear_edits[start];
@@ -54,41 +57,146 @@ std::string EditBuffer::preview(const std::string & source) const
             }
         }
     }
- 
-    // Apply the edits in order, emitting the modified text.
+}
+
+std::string EditBuffer::preview(const std::string & source) const
+{
+    const std::vector<EditSpan> & pieces = spans();
+
+    size_t size = source.size();
+    for (auto & span : pieces)
+        size += span.text.size();
+    std::string result;
+    result.reserve(size);
+
+    // Copy the unmodified source between the edits a span at a time,
+    // and the text of each edit in its place.
+    SourceOffset idx = 0;
+    SourceOffset end = source.size();
+    for (auto & span : pieces) {
+        SourceOffset stop = std::min(span.begin, end);
+        if (idx < stop)
+            result.append(source, idx, stop - idx);
+        result += span.text;
+        idx = std::max(idx, span.end);
+    }
+    if (idx < end)
+        result.append(source, idx, end - idx);
+
+    return result;
+}
+
+std::string EditBuffer::diff(const std::string & source,
+                             const std::string & path) const
+{ return unifiedDiff(source, spans(), path); }
+
+Fingerprint EditBuffer::fingerprint(const std::string & source,
+                                    const SourceHashes & hashes) const
+{ return fingerprintOf(source, hashes, spans()); }
+
+std::vector<EditTarget> EditBuffer::targets() const
+{
+    std::map<SourceOffset, LinearEdit> linear_edits;
+    std::vector<EditTarget> result;
+    std::map<AstRef, Edit> flat;
+    linearize(base ? (flat = flatten()) : edits, linear_edits, &result);
+    return result;
+}
+
+const std::vector<EditSpan> & EditBuffer::spans() const
+{
+    if (cached_spans)
+        return *cached_spans;
+
+    std::map<SourceOffset, LinearEdit> linear_edits;
+    std::map<AstRef, Edit> flat;
+    linearize(base ? (flat = flatten()) : edits, linear_edits, NULL);
+
+    // Skip any edit which starts within the text replaced by an
+    // earlier one, keeping track of how far the modified text has
+    // moved relative to the original.
+    std::shared_ptr<std::vector<EditSpan> > result(
+        new std::vector<EditSpan>());
     SourceOffset idx = 0;
+    SourceOffset shift = 0;
     for (auto & e : linear_edits) {
         if (idx > e.first)
             continue;
-        // Emit any unmodified text before this edit.
-        while (idx < e.first)
-            oss << source[idx++];
-        // Perform the edit itself
-        oss << e.second.text;
-        idx += e.second.advance_by;
+        idx = e.first + e.second.advance_by;
+        if (e.second.text.empty() && e.second.advance_by == 0)
+            continue;
+        result->push_back({ e.first, idx, e.first + shift, e.second.text });
+        shift += SourceOffset(e.second.text.size())
+               - SourceOffset(e.second.advance_by);
+    }
+    cached_spans = result;
+    return *cached_spans;
+}
+
+void EditBuffer::freeze()
+{
+    if (edits.empty())
+        return;
+    std::shared_ptr<EditLayer> layer(new EditLayer());
+    layer->parent = base;
+    layer->edits.swap(edits);
+    base = layer;
+}
+
+std::map<AstRef, Edit> EditBuffer::flatten() const
+{
+    std::vector<const std::map<AstRef, Edit> *> layers(1, &edits);
+    for (const EditLayer * layer = base.get();
+         layer != NULL;
+         layer = layer->parent.get())
+    {
+        layers.push_back(&layer->edits);
+    }
+
+    // Each layer's edit to an Ast holds what that layer's operations
+    // did to it, so applying the layers oldest first gives the same
+    // edit as applying all of the operations to one buffer would. A
+    // replacement leaves the adjustments of an earlier one alone
+    // unless it set its own, as replaceText does in one buffer.
+    std::map<AstRef, Edit> result;
+    for (auto it = layers.rbegin(); it != layers.rend(); ++it) {
+        for (auto & e : **it) {
+            Edit & edit = result[e.first];
+            const Edit & later = e.second;
+            edit.prefix += later.prefix;
+            edit.suffix = later.suffix + edit.suffix;
+            if (later.skipTo != NoAst) {
+                edit.text = later.text;
+                edit.skipTo = later.skipTo;
+            }
+            if (later.adjusted) {
+                edit.preAdjust = later.preAdjust;
+                edit.postAdjust = later.postAdjust;
+                edit.adjusted = true;
+            }
+        }
     }
-    // Emit any unmodified text at the end of the buffer.
-    while (idx < (int) source.size())
-        oss << source[idx++];
-    
-    return oss.str();
+    return result;
 }
 
 void EditBuffer::insertBefore(AstRef ast, const std::string & text)
 {
     Edit & edit = edits[ast];
+    cached_spans.reset();
     edit.prefix += text;
 }
 
 void EditBuffer::insertAfter(AstRef ast, const std::string & text)
 {
     Edit & edit = edits[ast];
+    cached_spans.reset();
     edit.suffix = text + edit.suffix;
 }
 
 void EditBuffer::replaceText(AstRef ast, const std::string & text)
 {
     Edit & edit = edits[ast];
+    cached_spans.reset();
     edit.skipTo = ast;
     edit.text = text;
 }
@@ -98,8 +206,10 @@ void EditBuffer::replaceTextRange(AstRef stmt1, AstRef stmt2,
                                   int preAdjust, int postAdjust)
 {
     Edit & edit = edits[stmt1];
+    cached_spans.reset();
     edit.text = text;
     edit.skipTo = stmt2;
     edit.preAdjust = preAdjust;
     edit.postAdjust = postAdjust;
+    edit.adjusted = true;
 }
@@ -3,10 +3,18 @@
 
 #include "AstRef.h"
 
+#include <map>
+#include <memory>
 #include <string>
+#include <vector>
 
 namespace clang_mutate {
 
+typedef int SourceOffset;
+
+struct Fingerprint;
+class SourceHashes;
+
 struct Edit
 {
     Edit() : prefix("")
@@ -15,18 +23,57 @@ struct Edit
            , skipTo(NoAst)
            , preAdjust(0)
            , postAdjust(0)
+           , adjusted(false)
     {}
     std::string prefix;
     std::string text;
     std::string suffix;
     AstRef skipTo;
     int preAdjust, postAdjust;
+    // Whether preAdjust and postAdjust were set (by replaceTextRange),
+    // rather than left as they were.
+    bool adjusted;
+};
+
+// An edit as preview() will apply it: the Asts from `first` to `last`
+// have their text replaced if `replaces`, or else only have text
+// inserted around them.
+struct EditTarget
+{
+    AstRef first;
+    AstRef last;
+    bool replaces;
+};
+
+// A change preview() makes to the source: the text in [begin, end) of
+// the original source becomes `text`, which starts at `new_begin` in
+// the modified source. Together with the source, the spans of an
+// EditBuffer make up a piece table for the modified text: the pieces
+// are the spans' texts and the unchanged source between them.
+struct EditSpan
+{
+    SourceOffset begin;
+    SourceOffset end;
+    SourceOffset new_begin;
+    std::string text;
+};
+
+// Edits frozen by EditBuffer::freeze, which any number of buffers may
+// share: `edits` apply on top of those of `parent`.
+struct EditLayer
+{
+    std::shared_ptr<const EditLayer> parent;
+    std::map<AstRef, Edit> edits;
 };
 
+// The pending edits to a TU. A buffer holds the edits made since it
+// was last frozen, on top of a chain of frozen layers which it shares
+// with its copies, so that copying a frozen buffer (to branch off a
+// variant) costs nothing, and the branches cost only their own edits.
 class EditBuffer
 {
 public:
-    EditBuffer() : edits() {}
+    EditBuffer() : base(), edits(), cached_spans() {}
 
     void insertBefore (AstRef ast, const std::string & text);
     void insertAfter  (AstRef ast, const std::string & text);
@@ -36,10 +83,37 @@ public:
                            int preAdjust = 0, int postAdjust = 0);
     
     std::string preview(const std::string & source) const;
-    
+
+    // A unified diff from `source` to preview(source), naming the file
+    // `path`, worked out from spans() rather than from the whole
+    // modified text (see Diff.h).
+    std::string diff(const std::string & source,
+                     const std::string & path) const;
+
+    // The fingerprint of preview(source), worked out from spans() and
+    // the `hashes` of `source` (see Fingerprint.h).
+    Fingerprint fingerprint(const std::string & source,
+                            const SourceHashes & hashes) const;
+
+    // The edits which preview() will apply, in order, leaving out
+    // those within a replaced subtree.
+    std::vector<EditTarget> targets() const;
+
+    // The changes which preview() will make, in source order. These
+    // are worked out from the edits only once, until the next edit.
+    const std::vector<EditSpan> & spans() const;
+
+    // Move the edits made since the last freeze into a layer of their
+    // own, to be shared by copies of this buffer.
+    void freeze();
+
 private:
+    // All of the edits, with those of each layer applied in turn.
+    std::map<AstRef, Edit> flatten() const;
 
+    std::shared_ptr<const EditLayer> base;
     std::map<AstRef, Edit> edits;
+    mutable std::shared_ptr<const std::vector<EditSpan> > cached_spans;
 };
 
 } // end namespace clang_mutate
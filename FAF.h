@@ -2,43 +2,131 @@
 #define CLANG_MUTATE_FAF_H
 
 // This class is a replacement for clang's FrontendActionFactory,
-// with the property that the lifetimes of the CompilerInstances
-// are not managed by the factory.  Instead, instantiated
-// CompilerInstances are put into the global list TUs along with
-// their AstTables; clang_mutate is then the owner of these
-// instances.
+// which builds each source file into a TU in the global list TUs.
+// Each CompilerInstance lives only as long as it takes to build its
+// TU; the TU is then detached from it (see TU::detach) and the
+// compiler, with its ASTContext and Preprocessor, is destroyed.
+//
+// Unlike ClangTool, which moves the whole process into the directory
+// of each compile command it runs, runCommand gives the command's
+// directory to its compiler alone as the working directory (as a
+// reparse does; see Reparse.h), so that commands from any number of
+// directories can be built at once.
 
+#include "Macros.h"
 #include "TU.h"
+#include "clang/Basic/FileManager.h"
+#include "clang/Frontend/CompilerInvocation.h"
 #include "clang/Frontend/FrontendActions.h"
 #include "clang/Frontend/PCHContainerOperations.h"
+#include "clang/Frontend/Utils.h"
+#include "clang/Tooling/ArgumentsAdjusters.h"
 #include "clang/Tooling/Tooling.h"
+#include "llvm/Support/FileSystem.h"
 
 class FAF : public clang::tooling::FrontendActionFactory
 {
 public:
+    FAF() : next_tuid(0), reserved(false), directory() {}
     ~FAF() override;
 
+    // Number the TUs created by this factory from `first` onward,
+    // instead of reserving a fresh id for each one. The ids must have
+    // been reserved with clang_mutate::reserveTURefs.
+    void useReservedTURefs(clang_mutate::TURef first)
+    {
+        next_tuid = first;
+        reserved = true;
+    }
+
+    // Build the TU for `command`, with paths in it taken relative to
+    // its directory rather than the current one. Returns false if the
+    // command could not be run or the TU had errors.
+    bool runCommand(const clang::tooling::CompileCommand & command);
+
     virtual bool runInvocation(std::shared_ptr<clang::CompilerInvocation> Invocation,
                                clang::FileManager * Files,
                                std::shared_ptr<clang::PCHContainerOperations> PCHContainerOps,
                                clang::DiagnosticConsumer * DiagConsumer) override;
+
+private:
+    clang_mutate::TURef next_tuid;
+    bool reserved;
+    // The (absolute) directory of the command being run, from which
+    // the TU is reparsed.
+    std::string directory;
 };
 
 FAF::~FAF() {}
 
+bool FAF::runCommand(const clang::tooling::CompileCommand & command)
+{
+    using namespace clang::tooling;
+
+    // (Relative to the directory clang-mutate was run from, which it
+    // never leaves.)
+    llvm::SmallString<256> dir(command.Directory);
+    llvm::sys::fs::make_absolute(dir);
+    directory = dir.str();
+
+    // Adjust the command as ClangTool would, except that the driver
+    // and compiler look for the command's files in its directory.
+    // (createInvocationFromCommandLine adds -fsyntax-only.)
+    CommandLineArguments args =
+        getClangStripOutputAdjuster()(command.CommandLine, command.Filename);
+    args = getClangStripDependencyFileAdjuster()(args, command.Filename);
+    if (args.empty())
+        return false;
+    static int anchor;
+    bool has_resource_dir = false;
+    for (auto & arg : args)
+        has_resource_dir |= llvm::StringRef(arg).startswith("-resource-dir");
+    if (!has_resource_dir) {
+        args.insert(args.begin() + 1,
+                    "-resource-dir=" + clang::CompilerInvocation::
+                        GetResourcesPath("clang_tool", &anchor));
+    }
+    args.insert(args.begin() + 1, "-working-directory=" + directory);
+
+    std::vector<const char *> argv;
+    for (auto & arg : args)
+        argv.push_back(arg.c_str());
+    std::shared_ptr<clang::CompilerInvocation> invocation =
+        clang::createInvocationFromCommandLine(argv);
+    if (!invocation)
+        return false;
+    invocation->getFileSystemOpts().WorkingDir = directory;
+
+    llvm::IntrusiveRefCntPtr<clang::FileManager> files(
+        new clang::FileManager(invocation->getFileSystemOpts()));
+    return runInvocation(invocation,
+                         files.get(),
+                         std::make_shared<clang::PCHContainerOperations>(),
+                         nullptr);
+}
+
 bool FAF::runInvocation(std::shared_ptr<clang::CompilerInvocation> Invocation,
                         clang::FileManager * Files,
                         std::shared_ptr<clang::PCHContainerOperations> PCHContainerOps,
                         clang::DiagnosticConsumer * DiagConsumer)
 {
-    static clang_mutate::TURef next_tuid = 0;
     clang::CompilerInstance * Compiler = new clang::CompilerInstance;
-    clang_mutate::TURef tuid = next_tuid++;
-    clang_mutate::TUs[tuid] = new clang_mutate::TU(tuid, Compiler);
+    clang_mutate::TURef tuid = reserved
+        ? next_tuid++
+        : clang_mutate::reserveTURefs(1);
+    clang_mutate::TU * tu = new clang_mutate::TU(tuid, Compiler);
+    clang_mutate::registerTU(tu);
 
-    clang_mutate::tu_in_progress = clang_mutate::TUs[tuid];
+    clang_mutate::tu_in_progress = tu;
 
+    // Nothing from the ASTContext is used once the TU is built, so let
+    // clang free it rather than leaking it on purpose.
+    Invocation->getFrontendOpts().DisableFree = false;
     Compiler->setInvocation(Invocation);
+
+    // Keep what is needed to reparse the TU after it has been edited.
+    tu->invocation = std::make_shared<clang::CompilerInvocation>(*Invocation);
+    tu->directory = directory;
     Compiler->setFileManager(Files);
     Compiler->createDiagnostics(DiagConsumer, /*ShouldOwnClient=*/false);
     Compiler->createSourceManager(*Files);
@@ -50,9 +138,8 @@ bool FAF::runInvocation(std::shared_ptr<clang::CompilerInvocation> Invocation,
 
     const bool Success = Compiler->ExecuteAction(*ScopedToolAction);
 
-    clang::SourceManager & sm = Compiler->getSourceManager();
-    clang_mutate::tu_in_progress->source
-        = sm.getBufferData(sm.getMainFileID()).str();
+    ScopedToolAction.reset();
+    tu->detach();
 
     Files->clearStatCaches();
     return Success;
@@ -19,9 +19,21 @@ AST_FIELD( parent_counter, AstRef,
   { return ast.parent(); }
   )
 
+AST_FIELD( entry_index, AstCounter,
+  "Pre-order index at which this node is entered (its counter).",
+  { return ast.entry_index(); }
+  )
+
+AST_FIELD( exit_index, AstCounter,
+  "Counter of the last node in this node's subtree. A node's\n"
+  "descendants are those whose counters are greater than its\n"
+  "entry_index and no greater than its exit_index.",
+  { return ast.exit_index(); }
+  )
+
 AST_FIELD( class, std::string,
   "Class name of AST node.",
-  { return ast.className(); }
+  { return ast.className().str(); }
   )
 
 AST_FIELD( src_file_name, std::string,
@@ -62,7 +74,7 @@ AST_FIELD( children, std::vector<AstRef>,
 
 AST_FIELD_P( stmt_list, std::vector<AstRef>,
   "For a CompoundStmt, the list of immediate children.",
-  (ast.className() == "CompoundStmt"),
+  (ast.className() == AstClass::CompoundStmt),
   { return ast.children(); }
   )
 
@@ -74,8 +86,8 @@ AST_FIELD_P( successors, std::vector<AstRef>,
 
 AST_FIELD_P( opcode, std::string,
   "For a BinaryOp, the name of the operation.",
-  (ast.opcode() != ""),
-  { return ast.opcode(); }
+  (!ast.opcode().empty()),
+  { return ast.opcode().str(); }
   )
 
 AST_FIELD( macros, std::set<Hash>,
@@ -160,18 +172,16 @@ AST_FIELD( end_norm_off, unsigned int,
 
 AST_FIELD( orig_text, std::string,
   "Original source code for this node.",
-  {
-      RewriterState state;
-      getTextAs(ast.counter(), "$result", true)->run(state);
-      return state.vars["$result"];
-  } )
+  { return getAstText(ast.counter(), true); }
+  )
 
 AST_FIELD( src_text, std::string,
   "Original source code, with free identifiers X replaced by (|X|).",
   {
-      RewriterState state;
-      getTextAs(ast.counter(), "$result")->run(state);
-      return ast.replacements().apply_to(state.vars["$result"]);
+      return ast.replacements().apply_to(getAstText(ast.counter(), false),
+                                         tu.renames,
+                                         ast.freeVariables(),
+                                         ast.freeFunctions());
   } )
 
 AST_FIELD_P( binary_file_path, std::string,
@@ -231,7 +241,7 @@ AST_FIELD_P( llvm_ir_file_path, std::string,
 AST_FIELD_P( base_type, std::string,
   { "For field declarations, the base type name." },
   ast.is_field_decl(),
-  { return ast.base_type(); }
+  { return ast.base_type().str(); }
   )
 
 AST_FIELD_P( bit_field_width, unsigned,
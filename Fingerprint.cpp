@@ -0,0 +1,164 @@
+#include "Fingerprint.h"
+
+#include "TU.h"
+
+#include <algorithm>
+#include <cstdio>
+
+namespace clang_mutate {
+
+namespace {
+
+const uint64_t Modulus = (uint64_t(1) << 61) - 1;
+const uint64_t Bases[2] = { 0x0c4f1e5a7d3b2969ULL % Modulus,
+                            0x1b873593cc9e2d51ULL % Modulus };
+
+// How many bytes apart the prefixes in SourceHashes are.
+const size_t Interval = 64;
+
+uint64_t mulmod(uint64_t a, uint64_t b)
+{
+    unsigned __int128 product = (unsigned __int128) a * b;
+    uint64_t sum = (uint64_t(product) & Modulus) + uint64_t(product >> 61);
+    return sum >= Modulus ? sum - Modulus : sum;
+}
+
+uint64_t addmod(uint64_t a, uint64_t b)
+{
+    uint64_t sum = a + b;
+    return sum >= Modulus ? sum - Modulus : sum;
+}
+
+uint64_t submod(uint64_t a, uint64_t b)
+{ return a >= b ? a - b : a + Modulus - b; }
+
+uint64_t powmod(uint64_t base, uint64_t exponent)
+{
+    uint64_t result = 1;
+    for (; exponent != 0; exponent >>= 1) {
+        if (exponent & 1)
+            result = mulmod(result, base);
+        base = mulmod(base, base);
+    }
+    return result;
+}
+
+// The splitmix64 finalizer.
+uint64_t mix(uint64_t x)
+{
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+}
+
+} // end namespace
+
+std::string Fingerprint::str() const
+{
+    char buffer[33];
+    snprintf(buffer, sizeof(buffer), "%016llx%016llx",
+             (unsigned long long) hi, (unsigned long long) lo);
+    return buffer;
+}
+
+void TextHash::append(const char * data, size_t size)
+{
+    for (int lane = 0; lane < 2; ++lane) {
+        uint64_t hash = m_lanes[lane];
+        for (size_t i = 0; i < size; ++i) {
+            // Count bytes from 1, so that leading NULs still count.
+            hash = addmod(mulmod(hash, Bases[lane]),
+                          uint64_t((unsigned char) data[i]) + 1);
+        }
+        m_lanes[lane] = hash;
+    }
+    m_length += size;
+}
+
+void TextHash::append(const TextHash & next)
+{
+    for (int lane = 0; lane < 2; ++lane) {
+        m_lanes[lane] = addmod(
+            mulmod(m_lanes[lane], powmod(Bases[lane], next.m_length)),
+            next.m_lanes[lane]);
+    }
+    m_length += next.m_length;
+}
+
+Fingerprint TextHash::fingerprint() const
+{
+    Fingerprint result;
+    result.hi = mix(m_lanes[0] ^ mix(m_length));
+    result.lo = mix(m_lanes[1] ^ (m_length * 0x9e3779b97f4a7c15ULL));
+    return result;
+}
+
+SourceHashes::SourceHashes(const std::string & source)
+    : m_prefixes(1)
+{
+    m_prefixes.reserve(source.size() / Interval + 1);
+    for (size_t idx = Interval; idx <= source.size(); idx += Interval) {
+        TextHash hash = m_prefixes.back();
+        hash.append(source.data() + idx - Interval, Interval);
+        m_prefixes.push_back(hash);
+    }
+}
+
+TextHash SourceHashes::prefix(const std::string & source,
+                              SourceOffset end) const
+{
+    size_t stop = std::min<size_t>(std::max(end, 0), source.size());
+    size_t k = std::min(stop / Interval, m_prefixes.size() - 1);
+    TextHash hash = m_prefixes[k];
+    hash.append(source.data() + k * Interval, stop - k * Interval);
+    return hash;
+}
+
+TextHash SourceHashes::range(const std::string & source,
+                             SourceOffset begin,
+                             SourceOffset end) const
+{
+    // The prefix up to `end` is the prefix up to `begin`, shifted up
+    // by the length of the range, plus the range.
+    TextHash before = prefix(source, begin);
+    TextHash result = prefix(source, std::max(begin, end));
+    result.m_length -= before.m_length;
+    for (int lane = 0; lane < 2; ++lane) {
+        result.m_lanes[lane] = submod(
+            result.m_lanes[lane],
+            mulmod(before.m_lanes[lane],
+                   powmod(Bases[lane], result.m_length)));
+    }
+    return result;
+}
+
+const SourceHashes & sourceHashes(TU & tu)
+{
+    if (!tu.source_hashes)
+        tu.source_hashes.reset(new SourceHashes(tu.source));
+    return *tu.source_hashes;
+}
+
+Fingerprint fingerprintOf(const std::string & source,
+                          const SourceHashes & hashes,
+                          const std::vector<EditSpan> & spans)
+{
+    // Hash the unmodified source between the edits a span at a time,
+    // and the text of each edit in its place, as preview() copies
+    // them.
+    TextHash hash;
+    SourceOffset idx = 0;
+    SourceOffset end = source.size();
+    for (auto & span : spans) {
+        SourceOffset stop = std::min(span.begin, end);
+        if (idx < stop)
+            hash.append(hashes.range(source, idx, stop));
+        hash.append(span.text);
+        idx = std::max(idx, span.end);
+    }
+    if (idx < end)
+        hash.append(hashes.range(source, idx, end));
+    return hash.fingerprint();
+}
+
+} // end namespace clang_mutate
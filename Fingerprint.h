@@ -0,0 +1,89 @@
+#ifndef CLANG_MUTATE_FINGERPRINT_H
+#define CLANG_MUTATE_FINGERPRINT_H
+
+// Fingerprints of modified sources, worked out without building the
+// modified text. Text is hashed as a polynomial in each of two fixed
+// bases, modulo 2^61 - 1, so that the hash of a concatenation follows
+// from the hashes and lengths of its parts: a modified source is
+// hashed from the hashes of the unmodified source between its edits
+// (looked up in SourceHashes) and those of the edits' text. Two
+// buffers whose edits give the same text have the same fingerprint,
+// however the edits were made, and fingerprints are the same from one
+// run to the next.
+
+#include "EditBuffer.h"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace clang_mutate {
+
+struct TU;
+
+// A 128-bit fingerprint of some text.
+struct Fingerprint
+{
+    uint64_t hi, lo;
+
+    bool operator==(const Fingerprint & other) const
+    { return hi == other.hi && lo == other.lo; }
+
+    bool operator<(const Fingerprint & other) const
+    { return hi < other.hi || (hi == other.hi && lo < other.lo); }
+
+    // As 32 hex digits.
+    std::string str() const;
+};
+
+// The hash of some text, which more text can be appended to.
+class TextHash
+{
+public:
+    TextHash() : m_length(0) { m_lanes[0] = m_lanes[1] = 0; }
+
+    void append(const char * data, size_t size);
+    void append(const std::string & text)
+    { append(text.data(), text.size()); }
+    void append(const TextHash & next);
+
+    Fingerprint fingerprint() const;
+
+private:
+    friend class SourceHashes;
+    uint64_t m_lanes[2];
+    uint64_t m_length;
+};
+
+// Hashes of every prefix of a source, at regular intervals, from
+// which the hash of any range of it is worked out in time independent
+// of the length of the range.
+class SourceHashes
+{
+public:
+    SourceHashes(const std::string & source);
+
+    // The hash of [begin, end) of `source`, which must be the text
+    // these hashes were built from.
+    TextHash range(const std::string & source,
+                   SourceOffset begin,
+                   SourceOffset end) const;
+
+private:
+    TextHash prefix(const std::string & source, SourceOffset end) const;
+
+    std::vector<TextHash> m_prefixes;
+};
+
+// The SourceHashes of a TU's source, built on first use. Call it from
+// the main thread.
+const SourceHashes & sourceHashes(TU & tu);
+
+// The fingerprint of the text that the edits `spans` make of `source`.
+Fingerprint fingerprintOf(const std::string & source,
+                          const SourceHashes & hashes,
+                          const std::vector<EditSpan> & spans);
+
+} // end namespace clang_mutate
+
+#endif
@@ -14,6 +14,26 @@ FunctionInfo::FunctionInfo(FunctionDecl * decl)
     is_variadic = decl->isVariadic();    
 }
 
+void FunctionInfo::write(clang_mutate::BinaryWriter & out) const
+{
+    out.put(name);
+    out.put(ident);
+    out.put(returns_void);
+    out.put(is_variadic);
+    out.put(uint64_t(num_params));
+}
+
+FunctionInfo FunctionInfo::read(clang_mutate::BinaryReader & in)
+{
+    FunctionInfo f;
+    f.name = in.get_string();
+    f.ident = in.get_identifier();
+    f.returns_void = in.get_bool();
+    f.is_variadic = in.get_bool();
+    f.num_params = in.get_uint();
+    return f;
+}
+
 picojson::value FunctionInfo::toJSON() const
 {
     std::vector<picojson::value> ans;
@@ -1,6 +1,7 @@
 #ifndef CLANG_MUTATE_FUNCTION_H
 #define CLANG_MUTATE_FUNCTION_H
 
+#include "Serialization.h"
 #include "Utils.h"
 
 #include "clang/AST/AST.h"
@@ -27,8 +28,13 @@ public:
     { return ident < that.ident; }
 
     picojson::value toJSON() const;
+
+    void write(clang_mutate::BinaryWriter & out) const;
+    static FunctionInfo read(clang_mutate::BinaryReader & in);
     
 private:
+    FunctionInfo() {}
+
     std::string name;
     const clang::IdentifierInfo * ident;
     bool returns_void;
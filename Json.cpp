@@ -1,5 +1,8 @@
 #include "Json.h"
 
+#include <algorithm>
+#include <iterator>
+
 void append_arrays(picojson::array & xs, const picojson::array & ys)
 {
     for (picojson::array::const_iterator it = ys.begin(); it != ys.end(); ++it)
@@ -8,6 +11,37 @@ void append_arrays(picojson::array & xs, const picojson::array & ys)
 
 
 void serialize_as_sexpr(const picojson::value &x, std::ostream &os)
+{
+    SexpSyntax().value(os, x);
+}
+
+void JsonSyntax::value(std::ostream & os, const picojson::value & x) const
+{
+    os << x;
+}
+
+void JsonSyntax::begin_record(std::ostream & os) const
+{
+    os << '{';
+}
+
+void JsonSyntax::field(std::ostream & os,
+                       bool first,
+                       const std::string & key,
+                       const picojson::value & x) const
+{
+    if (!first)
+        os << ',';
+    picojson::serialize_str(key, std::ostream_iterator<char>(os));
+    os << ':' << x;
+}
+
+void JsonSyntax::end_record(std::ostream & os) const
+{
+    os << '}';
+}
+
+void SexpSyntax::value(std::ostream & os, const picojson::value & x) const
 {
     if (x.is<std::string>()) {
         // JSON escaping doesn't work for Lisp (e.g. newlines), so we have to
@@ -31,33 +65,18 @@ void serialize_as_sexpr(const picojson::value &x, std::ostream &os)
     else if (x.is<picojson::array>()) {
         // Serialize arrays as lists
         os << '(';
-        const picojson::array array = x.get<picojson::array>();
-        for (auto item : array) {
+        for (auto & item : x.get<picojson::array>()) {
             os << ' ';
-            serialize_as_sexpr(item, os);
+            value(os, item);
         }
         os << ')';
     }
     else if (x.is<picojson::object>()) {
         // Serialize objects as alists
-        os << '(';
-        const picojson::object object = x.get<picojson::object>();
-        for (auto item : object) {
-            // Don't bother printing (key . value) pairs when the
-            // value is NIL.  NIL may be either false or an empty list.
-            if (not ((item.second.is<bool>() and            // False NIL.
-                      not item.second.get<bool>()) or
-                     (item.second.is<picojson::array>() and // Empty list NIL.
-                      item.second.get<picojson::array>().size() == 0))) {
-                std::string key = item.first;
-                std::replace(key.begin(), key.end(), '_', '-');
-
-                os << "(:" << key << " . ";
-                serialize_as_sexpr(item.second, os);
-                os << ')';
-            }
-        }
-        os << ')';
+        begin_record(os);
+        for (auto & item : x.get<picojson::object>())
+            field(os, false, item.first, item.second);
+        end_record(os);
     }
     else if (x.is<bool>()) {
         os << (x.get<bool>() ? "T" : "NIL");
@@ -66,3 +85,94 @@ void serialize_as_sexpr(const picojson::value &x, std::ostream &os)
         os <<  x.to_str();
     }
 }
+
+void SexpSyntax::begin_record(std::ostream & os) const
+{
+    os << '(';
+}
+
+void SexpSyntax::field(std::ostream & os,
+                       bool,
+                       const std::string & key,
+                       const picojson::value & x) const
+{
+    // Don't bother printing (key . value) pairs when the
+    // value is NIL.  NIL may be either false or an empty list.
+    if ((x.is<bool>() and not x.get<bool>()) or
+        (x.is<picojson::array>() and x.get<picojson::array>().empty()))
+    {
+        return;
+    }
+    std::string sexp_key = key;
+    std::replace(sexp_key.begin(), sexp_key.end(), '_', '-');
+    os << "(:" << sexp_key << " . ";
+    value(os, x);
+    os << ')';
+}
+
+void SexpSyntax::end_record(std::ostream & os) const
+{
+    os << ')';
+}
+
+void StringTableSyntax::value(std::ostream & os,
+                              const picojson::value & x) const
+{
+    m_base.value(os, intern(x));
+}
+
+void StringTableSyntax::begin_record(std::ostream & os) const
+{
+    m_base.begin_record(os);
+}
+
+void StringTableSyntax::field(std::ostream & os,
+                              bool first,
+                              const std::string & key,
+                              const picojson::value & x) const
+{
+    if (m_keys.count(key))
+        m_base.field(os, first, key, intern(x));
+    else
+        m_base.field(os, first, key, x);
+}
+
+void StringTableSyntax::end_record(std::ostream & os) const
+{
+    m_base.end_record(os);
+}
+
+std::vector<std::pair<size_t, std::string> > StringTableSyntax::take_fresh()
+{
+    std::vector<std::pair<size_t, std::string> > fresh;
+    fresh.swap(m_fresh);
+    return fresh;
+}
+
+picojson::value StringTableSyntax::intern(const picojson::value & x) const
+{
+    if (x.is<std::string>()) {
+        const std::string & str = x.get<std::string>();
+        auto it = m_table.find(str);
+        if (it == m_table.end()) {
+            it = m_table.insert(std::make_pair(str, m_table.size())).first;
+            m_fresh.push_back(std::make_pair(it->second, str));
+        }
+        picojson::object ref;
+        ref["ref"] = to_json(it->second);
+        return picojson::value(ref);
+    }
+    else if (x.is<picojson::array>()) {
+        picojson::array array;
+        for (auto & item : x.get<picojson::array>())
+            array.push_back(intern(item));
+        return picojson::value(array);
+    }
+    else if (x.is<picojson::object>()) {
+        picojson::object object;
+        for (auto & item : x.get<picojson::object>())
+            object[item.first] = intern(item.second);
+        return picojson::value(object);
+    }
+    return x;
+}
@@ -3,6 +3,7 @@
 
 #include "third-party/picojson-1.3.0/picojson.h"
 
+#include <map>
 #include <string>
 #include <set>
 #include <vector>
@@ -168,4 +169,84 @@ struct describe_json<std::map<std::string, X>>
 
 void serialize_as_sexpr(const picojson::value &x, std::ostream &os);
 
+//
+//  A concrete syntax for writing values, and records (objects) one
+//  field at a time, straight to a stream.  A record is written as
+//  begin_record, then field for each key in order, then end_record;
+//  `first` is true for the first field of a record.
+//
+class RecordSyntax
+{
+public:
+    virtual ~RecordSyntax() {}
+    virtual void value(std::ostream & os, const picojson::value & x) const = 0;
+    virtual void begin_record(std::ostream & os) const = 0;
+    virtual void field(std::ostream & os,
+                       bool first,
+                       const std::string & key,
+                       const picojson::value & x) const = 0;
+    virtual void end_record(std::ostream & os) const = 0;
+};
+
+class JsonSyntax : public RecordSyntax
+{
+public:
+    void value(std::ostream & os, const picojson::value & x) const;
+    void begin_record(std::ostream & os) const;
+    void field(std::ostream & os,
+               bool first,
+               const std::string & key,
+               const picojson::value & x) const;
+    void end_record(std::ostream & os) const;
+};
+
+// Writes objects as alists, as serialize_as_sexpr does.
+class SexpSyntax : public RecordSyntax
+{
+public:
+    void value(std::ostream & os, const picojson::value & x) const;
+    void begin_record(std::ostream & os) const;
+    void field(std::ostream & os,
+               bool first,
+               const std::string & key,
+               const picojson::value & x) const;
+    void end_record(std::ostream & os) const;
+};
+
+// Writes through another syntax, with each string in the fields named
+// by `keys` replaced by a reference into a table of the strings seen
+// so far: an object {"ref": N} holding the index of its entry, which
+// (as those strings are never left as they are) cannot be mistaken
+// for a value. Other fields are written as they are. Strings not seen
+// before are added to the table, and kept until taken by take_fresh(),
+// so that the caller can write their entries out before the record
+// that uses them.
+class StringTableSyntax : public RecordSyntax
+{
+public:
+    StringTableSyntax(const RecordSyntax & base,
+                      const std::set<std::string> & keys)
+        : m_base(base), m_keys(keys)
+    {}
+
+    void value(std::ostream & os, const picojson::value & x) const;
+    void begin_record(std::ostream & os) const;
+    void field(std::ostream & os,
+               bool first,
+               const std::string & key,
+               const picojson::value & x) const;
+    void end_record(std::ostream & os) const;
+
+    // The entries added since the last call, as (index, string) pairs.
+    std::vector<std::pair<size_t, std::string> > take_fresh();
+
+private:
+    picojson::value intern(const picojson::value & x) const;
+
+    const RecordSyntax & m_base;
+    std::set<std::string> m_keys;
+    mutable std::map<std::string, size_t> m_table;
+    mutable std::vector<std::pair<size_t, std::string> > m_fresh;
+};
+
 #endif
@@ -5,7 +5,11 @@
 #include "clang/Lex/Lexer.h"
 #include "clang/Lex/Preprocessor.h"
 
+#include <algorithm>
 #include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
 #include <sstream>
 #include <utility>
 
@@ -94,25 +98,88 @@ MacroDB::MacroDB(clang::CompilerInstance * _CI) {
 }
 
 MacroDB & MacroDB::getInstance(CompilerInstance * _CI) {
-    static MacroDB macroDB(_CI);
+    return *getShared(_CI);
+}
+
+// One database per compiler instance, built on first use. TUs may
+// be built concurrently, so lookups are serialized.
+static std::mutex instances_mutex;
+static std::map<CompilerInstance*, std::shared_ptr<MacroDB> > instances;
+
+std::shared_ptr<MacroDB> MacroDB::getShared(CompilerInstance * _CI) {
+    std::lock_guard<std::mutex> lock(instances_mutex);
+    std::shared_ptr<MacroDB> & macroDB = instances[_CI];
+    if (!macroDB)
+        macroDB.reset(new MacroDB(_CI));
     return macroDB;
 }
 
+void MacroDB::release(CompilerInstance * _CI) {
+    std::lock_guard<std::mutex> lock(instances_mutex);
+    instances.erase(_CI);
+}
+
 const Macro* MacroDB::find(const PresumedLoc & loc) const {
     return m_macros.find(loc) != m_macros.end() ?
            &m_macros.find(loc)->second :
            NULL;
 }
 
-picojson::array MacroDB::databaseToJSON() {
+MacroDB::SortedMacros MacroDB::sorted() const {
+    SortedMacros ans;
+    for (auto & entry : m_macros)
+        ans.push_back(std::make_pair(entry.first, &entry.second));
+    std::sort(ans.begin(), ans.end(),
+              [](const std::pair<PresumedLoc, const Macro*> & a,
+                 const std::pair<PresumedLoc, const Macro*> & b)
+              {
+                  int cmp = strcmp(a.first.getFilename(),
+                                   b.first.getFilename());
+                  if (cmp != 0)
+                      return cmp < 0;
+                  if (a.first.getLine() != b.first.getLine())
+                      return a.first.getLine() < b.first.getLine();
+                  return a.first.getColumn() < b.first.getColumn();
+              });
+    return ans;
+}
+
+picojson::array MacroDB::databaseToJSON() const {
     picojson::array array;
-    for (MacroMap::iterator it = m_macros.begin();
-         it != m_macros.end();
-         ++it)
-    {
-        array.push_back(to_json(it->second));
-    }
+    for (auto & entry : sorted())
+        array.push_back(to_json(*entry.second));
     return array;
 }
 
+void MacroDB::write(BinaryWriter & out) const {
+    SortedMacros entries = sorted();
+    out.put(uint64_t(entries.size()));
+    for (auto & entry : entries) {
+        out.put(std::string(entry.first.getFilename()));
+        out.put(uint64_t(entry.first.getLine()));
+        out.put(uint64_t(entry.first.getColumn()));
+        out.put(entry.second->name());
+        out.put(entry.second->body());
+    }
+}
+
+std::shared_ptr<MacroDB> MacroDB::read(BinaryReader & in) {
+    std::shared_ptr<MacroDB> db(new MacroDB());
+    size_t n = in.get_uint();
+    for (size_t i = 0; i < n && !in.fail(); ++i) {
+        std::string filename = in.get_string();
+        unsigned line = in.get_uint();
+        unsigned col = in.get_uint();
+        std::string name = in.get_string();
+        std::string body = in.get_string();
+        if (db->m_filenames.empty() || db->m_filenames.back() != filename)
+            db->m_filenames.push_back(filename);
+        db->m_macros.insert(
+            std::make_pair(PresumedLoc(db->m_filenames.back().c_str(),
+                                       line, col, SourceLocation()),
+                           Macro(name, body)));
+    }
+    return db;
+}
+
 } // end namespace clang_mutate
@@ -3,6 +3,7 @@
 
 #include "Hash.h"
 #include "Json.h"
+#include "Serialization.h"
 #include "Utils.h"
 
 #include "clang/Basic/LLVM.h"
@@ -14,8 +15,11 @@
 #include "clang/Basic/SourceManager.h"
 #include "clang/Frontend/CompilerInstance.h"
 
+#include <list>
+#include <memory>
 #include <string>
 #include <unordered_map>
+#include <vector>
 
 namespace clang_mutate {
 
@@ -49,13 +53,22 @@ class MacroDB
 {
 public:
     static MacroDB & getInstance(clang::CompilerInstance * _CI);
+    static std::shared_ptr<MacroDB> getShared(clang::CompilerInstance * _CI);
+
+    // Forget the database for a compiler instance which is about to be
+    // destroyed. Holders of the database (from getShared) keep it.
+    static void release(clang::CompilerInstance * _CI);
 
     MacroDB(const MacroDB &) = delete;
     MacroDB& operator=(const MacroDB &) = delete;
 
     const Macro* find(const clang::PresumedLoc & loc) const;
 
-    picojson::array databaseToJSON();
+    // The macros, ordered by the location of their definitions.
+    picojson::array databaseToJSON() const;
+
+    void write(BinaryWriter & out) const;
+    static std::shared_ptr<MacroDB> read(BinaryReader & in);
 private:
     struct PresumedLocHash
     {
@@ -74,10 +87,20 @@ private:
                                PresumedLocEqualTo>
             MacroMap;
 
+    typedef std::vector<std::pair<clang::PresumedLoc, const Macro*> >
+            SortedMacros;
+
+    // The entries of m_macros, in order of definition.
+    SortedMacros sorted() const;
+
     MacroDB() {}
     MacroDB(clang::CompilerInstance *CI);
 
     MacroMap m_macros;
+
+    // Storage for the file names in a database that was read back
+    // in, which has no SourceManager to own them.
+    std::list<std::string> m_filenames;
 };
 
 } // end namespace clang_mutate
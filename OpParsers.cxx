@@ -95,6 +95,67 @@ struct preview_op
     { return { "Print the modified source for a translation unit." }; }
 };
 
+extern const char diff_[] = "diff";
+struct diff_op
+{
+    typedef str_<diff_> command;
+    typedef tokens< command, p_tu > parser;
+
+    static RewritingOpPtr make(TURef const& tu)
+    { return printDiff(tu); }
+
+    static std::vector<std::string> purpose()
+    { return { "Print a unified diff from the original to the modified"
+             , "source for a translation unit." }; }
+};
+
+extern const char fingerprint_[] = "fingerprint";
+struct fingerprint_op
+{
+    typedef str_<fingerprint_> command;
+    typedef tokens< command, p_tu > parser;
+
+    static RewritingOpPtr make(TURef const& tu)
+    { return fingerprint(tu); }
+
+    static std::vector<std::string> purpose()
+    { return { "Print a 128-bit hash of the modified source for a"
+             , "translation unit, worked out without building the"
+             , "modified source." }; }
+};
+
+extern const char reparse_[] = "reparse";
+struct reparse_op
+{
+    typedef str_<reparse_> command;
+    typedef tokens< command, p_tu > parser;
+
+    static RewritingOpPtr make(TURef const& tu)
+    { return reparse(tu); }
+
+    static std::vector<std::string> purpose()
+    { return { "Rebuild the ASTs of a translation unit from its modified"
+             , "source, and reset its rewrite buffer. If only one function"
+             , "body changed, only that function is rebuilt, and the ASTs"
+             , "before it keep their counters. Fails, leaving the"
+             , "translation unit as it was, if the source does not compile." }; }
+};
+
+extern const char apply_diff_[] = "apply-diff";
+struct apply_diff_op
+{
+    typedef str_<apply_diff_> command;
+    typedef tokens< command, p_tu, p_text > parser;
+
+    static RewritingOpPtr make(TURef const& tu, std::string const& path)
+    { return applyDiff(tu, path); }
+
+    static std::vector<std::string> purpose()
+    { return { "Rebuild the ASTs of a translation unit from its original"
+             , "source with a unified diff (as written by 'diff') applied,"
+             , "and reset its rewrite buffer." }; }
+};
+
 extern const char info_[] = "info";
 struct info_op
 {
@@ -115,7 +176,7 @@ struct info_op
         // working directory.
         std::vector<std::string> filenames;
         for (auto & tu : TUs) {
-            std::string filename = tu.second->filename;
+            std::string filename = tu.second->filename.str();
             if (filename.find(prefix) == 0)
                 filename = filename.substr(prefix.size());
             if (filename.size() + 2 > maxFilenameLength)
@@ -232,7 +293,7 @@ struct macros_op
     {
         TU & tu = *TUs[tuid];
         std::ostringstream oss;
-        oss << to_json(MacroDB::getInstance(tu.ci).databaseToJSON());
+        oss << to_json(tu.macros->databaseToJSON());
         return echo(oss.str());
     }
 
@@ -323,6 +384,59 @@ struct reset_op
     }
 };
 
+extern const char snapshot_[] = "snapshot";
+struct snapshot_op
+{
+    typedef str_<snapshot_> command;
+    typedef tokens< command, p_tu, tokens<str_<as_>, snapshot_name> > parser;
+
+    static RewritingOpPtr make(TURef const& tu, std::string const& name)
+    { return takeSnapshot(tu, name); }
+
+    static std::vector<std::string> purpose()
+    {
+        return { "Save a translation unit's rewrite buffer under the given"
+               , "name, to be brought back later by 'restore'."
+               };
+    }
+};
+
+extern const char restore_[] = "restore";
+struct restore_op
+{
+    typedef str_<restore_> command;
+    typedef tokens< command, snapshot_name > parser;
+
+    static RewritingOpPtr make(std::string const& name)
+    { return restoreSnapshot(name); }
+
+    static std::vector<std::string> purpose()
+    {
+        return { "Replace the rewrite buffer of a snapshot's translation"
+               , "unit with the snapshot's buffer."
+               };
+    }
+};
+
+extern const char fork_[] = "fork";
+struct fork_op
+{
+    typedef str_<fork_> command;
+    typedef tokens< command, snapshot_name,
+                    tokens<str_<as_>, snapshot_name> > parser;
+
+    static RewritingOpPtr make(std::string const& name,
+                               std::string const& child)
+    { return forkSnapshot(name, child); }
+
+    static std::vector<std::string> purpose()
+    {
+        return { "Save a copy of a snapshot under another name. The copy"
+               , "shares the snapshot's edits."
+               };
+    }
+};
+
 extern const char binary_[] = "binary";
 struct binary_op
 {
@@ -391,6 +505,37 @@ struct ids_op
     { return { "Print the number of ASTs in a translation unit." }; }
 };
 
+extern const char memory_[] = "memory";
+struct memory_op
+{
+    typedef str_<memory_> command;
+    typedef tokens< command, p_tu > parser;
+
+    static RewritingOpPtr make(TURef const& tuid)
+    {
+        TU & tu = *TUs[tuid];
+        size_t asts = tu.asts.size();
+        size_t arena = tu.ast_arena.bytesReserved();
+        size_t payload = 0;
+        for (auto & ast : tu.asts)
+            payload += ast->memoryUsage() - sizeof(Ast);
+
+        std::map<std::string, picojson::value> ans;
+        ans["asts"] = to_json(asts);
+        ans["ast_bytes"] = to_json(sizeof(Ast));
+        ans["arena_bytes"] = to_json(arena);
+        ans["payload_bytes"] = to_json(payload);
+        ans["bytes_per_ast"] =
+            to_json(asts == 0 ? 0 : (arena + payload) / asts);
+        return echo(to_json(ans).serialize());
+    }
+
+    static std::vector<std::string> purpose()
+    { return { "Print the memory used by the ASTs of a translation unit,"
+             , "in total and per AST: the arena holding the ASTs, and"
+             , "the heap memory of their fields (payload_bytes)." }; }
+};
+
 class ClassAnnotator : public Annotator
 {
 public:
@@ -516,7 +661,7 @@ struct list_op
                     ast->begin_src_pos().getColumn(),
                     ast->end_src_pos().getLine(),
                     ast->end_src_pos().getColumn(),
-                    ast->className().c_str());
+                    ast->className().str().c_str());
             Utils::Optional<AddressRange> addrRange = ast->binaryAddressRange();
             if (addrRange) {
                 sprintf(msg + strlen(msg), " %#016lx %#016lx",
@@ -731,54 +876,27 @@ struct json_op
         TURef const& tuid,
         Optional<std::vector<std::string>> const& aux_fields,
         Optional<std::vector<std::string>> const& ast_fields)
-    {
-        TU & tu = *TUs[tuid];
-        std::string sep = "";
-        std::ostringstream oss;
-        oss << "[";
+    { return dump(tuid, aux_fields, ast_fields, Dump_Array); }
 
-        bool include_aux = false;
+    static RewritingOpPtr dump(
+        TURef const& tuid,
+        Optional<std::vector<std::string>> const& aux_fields,
+        Optional<std::vector<std::string>> const& ast_fields,
+        DumpFormat format)
+    {
         std::set<std::string> aux_keys;
         std::vector<std::string> auxf = { "types", "macros", "decls", "asts" };
         (void) aux_fields.get(auxf);
         for (auto & a : auxf)
             aux_keys.insert(a);
-        for (auto & aux_key : aux_keys) {
-            if (aux_key == "types") {
-                for (auto & entry : TypeDBEntry::databaseToJSON()) {
-                    oss << sep << to_json(entry);
-                    sep = ",";
-                }
-            }
-            else if (aux_key == "macros") {
-                for (auto & entry : MacroDB::getInstance(tu.ci)
-                                            .databaseToJSON()) {
-                    oss << sep << to_json(entry);
-                    sep = ",";
-                }
-            }
-            else if (aux_key == "asts") {
-                include_aux = true;
-            }
-            else {
-                for (auto & entry : tu.aux[aux_key]) {
-                    oss << sep << to_json(entry);
-                    sep = ",";
-                }
-            }
-        }
 
         std::set<std::string> ast_keys;
         std::vector<std::string> astf;
         (void) ast_fields.get(astf);
         for (auto & a : astf)
             ast_keys.insert(a);
-        for (auto & ast : tu.asts) {
-            oss << sep << ast->toJSON(ast_keys, include_aux);
-            sep = ",";
-        }
-        oss << "]";
-        return echo(oss.str());
+
+        return dumpTU(tuid, aux_keys, ast_keys, format);
     }
 
     static std::vector<std::string> purpose()
@@ -786,75 +904,120 @@ struct json_op
              , "Use '?fields' to get a description of each JSON field." }; }
 };
 
-// Note: this is a copy of json_op with only minor changes to the
-// serialization code. Could probably be refactored.
-extern const char sexp_[] = "sexp";
-struct sexp_op
+extern const char jsonl_[] = "jsonl";
+struct jsonl_op
 {
-    typedef str_<sexp_> command;
+    typedef str_<jsonl_> command;
     typedef tokens< command, p_tu, kwarg<jaux_>, kwarg<jfields_> > parser;
 
     static RewritingOpPtr make(
         TURef const& tuid,
         Optional<std::vector<std::string>> const& aux_fields,
         Optional<std::vector<std::string>> const& ast_fields)
-    {
-        TU & tu = *TUs[tuid];
-        std::string sep = "";
-        std::ostringstream oss;
-        oss << "(";
+    { return json_op::dump(tuid, aux_fields, ast_fields, Dump_Lines); }
 
-        bool include_aux = false;
-        std::set<std::string> aux_keys;
-        std::vector<std::string> auxf = { "types", "macros", "decls", "asts" };
-        (void) aux_fields.get(auxf);
-        for (auto & a : auxf)
-            aux_keys.insert(a);
-        for (auto & aux_key : aux_keys) {
-            if (aux_key == "types") {
-                for (auto & entry : TypeDBEntry::databaseToJSON()) {
-                    oss << sep;
-                    serialize_as_sexpr(entry, oss);
-                    sep = "\n";
-                }
-            }
-            else if (aux_key == "macros") {
-                for (auto & entry : MacroDB::getInstance(tu.ci)
-                                            .databaseToJSON()) {
-                    oss << sep;
-                    serialize_as_sexpr(entry, oss);
-                    sep = "\n";
-                }
-            }
-            else if (aux_key == "asts") {
-                include_aux = true;
-            }
-            else {
-                for (auto & entry : tu.aux[aux_key]) {
-                    oss << sep;
-                    serialize_as_sexpr(entry, oss);
-                    sep = "\n";
-                }
-            }
-        }
+    static std::vector<std::string> purpose()
+    { return { "Dump the representation of a translation unit as JSON Lines:"
+             , "each aux entry, then each AST in counter order, as a JSON"
+             , "object on a line of its own. Takes the same arguments as json." }; }
+};
+
+extern const char packed_[] = "packed";
+struct packed_op
+{
+    typedef str_<packed_> command;
+    typedef tokens< command, p_tu, kwarg<jaux_>, kwarg<jfields_> > parser;
 
+    static RewritingOpPtr make(
+        TURef const& tuid,
+        Optional<std::vector<std::string>> const& aux_fields,
+        Optional<std::vector<std::string>> const& ast_fields)
+    { return json_op::dump(tuid, aux_fields, ast_fields, Dump_Packed); }
+
+    static std::vector<std::string> purpose()
+    { return { "Dump the entries that json would, as a compact binary stream"
+             , "(see Packed.h). Takes the same arguments as json." }; }
+};
+
+extern const char json_delta_[] = "json-delta";
+struct json_delta_op
+{
+    typedef str_<json_delta_> command;
+    typedef tokens< command, p_tu, kwarg<jfields_> > parser;
+
+    static RewritingOpPtr make(
+        TURef const& tuid,
+        Optional<std::vector<std::string>> const& ast_fields)
+    {
         std::set<std::string> ast_keys;
         std::vector<std::string> astf;
         (void) ast_fields.get(astf);
         for (auto & a : astf)
             ast_keys.insert(a);
-        for (auto & ast : tu.asts) {
-            oss << sep;
-            serialize_as_sexpr(ast->toJSON(ast_keys, include_aux), oss);
-            sep = "\n";
-        }
-        oss << ")";
-        return echo(oss.str());
+        return jsonDelta(tuid, ast_keys);
     }
 
     static std::vector<std::string> purpose()
-    { return { "Dump the representation of a translation unit as JSON."
-             , "Use '?fields' to get a description of each JSON field." }; }
+    { return { "Report what the pending edits to a translation unit change:"
+             , "the text spans they rewrite, the counters of the ASTs they"
+             , "replace, remove or enclose, and the JSON of the replaced and"
+             , "enclosing ASTs. The edits are left pending." }; }
+};
+
+extern const char batch_[] = "batch";
+struct batch_op
+{
+    typedef str_<batch_> command;
+    typedef tokens< command, p_tu, p_text > parser;
+
+    static RewritingOpPtr make(TURef const& tuid, std::string const& path)
+    { return batch(tuid, path); }
+
+    static std::vector<std::string> purpose()
+    { return { "Apply each mutation listed in a JSON Lines manifest to a"
+             , "fresh copy of a translation unit, in parallel, and write"
+             , "each variant to its own file or to a framed stream. See"
+             , "Batch.h for the formats." }; }
+};
+
+extern const char columns_[] = "columns";
+struct columns_op
+{
+    typedef str_<columns_> command;
+    typedef tokens< command, p_tu, p_text, kwarg<jfields_> > parser;
+
+    static RewritingOpPtr make(
+        TURef const& tuid,
+        std::string const& path,
+        Optional<std::vector<std::string>> const& ast_fields)
+    {
+        std::vector<std::string> fields;
+        (void) ast_fields.get(fields);
+        return writeColumns(tuid, path, fields);
+    }
+
+    static std::vector<std::string> purpose()
+    { return { "Write the ASTs of a translation unit to a file as columns,"
+             , "one per field (by default, every field). See Columns.h for"
+             , "the layout." }; }
+};
+
+extern const char sexp_[] = "sexp";
+struct sexp_op
+{
+    typedef str_<sexp_> command;
+    typedef tokens< command, p_tu, kwarg<jaux_>, kwarg<jfields_> > parser;
+
+    static RewritingOpPtr make(
+        TURef const& tuid,
+        Optional<std::vector<std::string>> const& aux_fields,
+        Optional<std::vector<std::string>> const& ast_fields)
+    { return json_op::dump(tuid, aux_fields, ast_fields, Dump_Sexp); }
+
+    static std::vector<std::string> purpose()
+    { return { "Dump the representation of a translation unit as a list of"
+             , "s-expressions, with each JSON object written as an alist."
+             , "Use '?fields' to get a description of each field." }; }
 };
 
 extern const char load_[] = "load";
@@ -902,12 +1065,11 @@ struct unload_op
 
     static RewritingOpPtr make(TURef const& tu)
     {
-        auto it = TUs.find(tu);
         std::ostringstream oss;
-        oss << "unloaded translation unit " << it->first;
-        auto op = reset_buffer(it->first);
-        delete it->second;
-        TUs.erase(it);
+        oss << "unloaded translation unit " << tu;
+        auto op = reset_buffer(tu);
+        delete TUs[tu];
+        TUs.erase(tu);
         return op->then(echo(oss.str()));
     }
 
@@ -0,0 +1,277 @@
+#include "Output.h"
+
+#include <zlib.h>
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+namespace clang_mutate {
+
+namespace {
+
+const size_t ChunkSize = 1 << 18;
+const size_t MaxQueued = 4;
+
+bool ends_with(const std::string & s, const std::string & suffix)
+{
+    return s.size() >= suffix.size()
+        && s.compare(s.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+} // end namespace
+
+// Compresses the chunks of a stream, in order, onto `out`.
+class Compressor
+{
+public:
+    virtual ~Compressor() {}
+    virtual bool write(const char * data, size_t size, std::ostream & out) = 0;
+    virtual bool finish(std::ostream & out) = 0;
+};
+
+namespace {
+
+class PlainWriter : public Compressor
+{
+public:
+    bool write(const char * data, size_t size, std::ostream & out)
+    {
+        out.write(data, size);
+        return bool(out);
+    }
+
+    bool finish(std::ostream & out)
+    { return bool(out); }
+};
+
+class GzipCompressor : public Compressor
+{
+public:
+    GzipCompressor()
+    {
+        stream.zalloc = Z_NULL;
+        stream.zfree = Z_NULL;
+        stream.opaque = Z_NULL;
+        // A window of 15 bits, plus 16 for a gzip header and trailer.
+        failed = deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED,
+                              15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK;
+    }
+
+    ~GzipCompressor()
+    {
+        if (!failed)
+            deflateEnd(&stream);
+    }
+
+    bool write(const char * data, size_t size, std::ostream & out)
+    { return deflate_into(data, size, Z_NO_FLUSH, out); }
+
+    bool finish(std::ostream & out)
+    { return deflate_into(NULL, 0, Z_FINISH, out); }
+
+private:
+    bool deflate_into(const char * data, size_t size, int flush,
+                      std::ostream & out)
+    {
+        if (failed)
+            return false;
+        char buffer[1 << 16];
+        stream.next_in = (Bytef*) data;
+        stream.avail_in = size;
+        do {
+            stream.next_out = (Bytef*) buffer;
+            stream.avail_out = sizeof(buffer);
+            if (deflate(&stream, flush) == Z_STREAM_ERROR)
+                return false;
+            out.write(buffer, sizeof(buffer) - stream.avail_out);
+        } while (stream.avail_out == 0);
+        return bool(out);
+    }
+
+    z_stream stream;
+    bool failed;
+};
+
+#ifdef HAVE_ZSTD
+class ZstdCompressor : public Compressor
+{
+public:
+    ZstdCompressor() : ctx(ZSTD_createCCtx()) {}
+
+    ~ZstdCompressor()
+    { ZSTD_freeCCtx(ctx); }
+
+    bool write(const char * data, size_t size, std::ostream & out)
+    { return compress_into(data, size, ZSTD_e_continue, out); }
+
+    bool finish(std::ostream & out)
+    { return compress_into(NULL, 0, ZSTD_e_end, out); }
+
+private:
+    bool compress_into(const char * data, size_t size,
+                       ZSTD_EndDirective mode, std::ostream & out)
+    {
+        if (ctx == NULL)
+            return false;
+        std::vector<char> buffer(ZSTD_CStreamOutSize());
+        ZSTD_inBuffer input = { data, size, 0 };
+        for (;;) {
+            ZSTD_outBuffer output = { buffer.data(), buffer.size(), 0 };
+            size_t remaining = ZSTD_compressStream2(ctx, &output, &input, mode);
+            if (ZSTD_isError(remaining))
+                return false;
+            out.write(buffer.data(), output.pos);
+            if (mode == ZSTD_e_end ? remaining == 0
+                                   : input.pos == input.size)
+                break;
+        }
+        return bool(out);
+    }
+
+    ZSTD_CCtx * ctx;
+};
+#endif
+
+} // end namespace
+
+bool parseCompression(const std::string & name,
+                      const std::string & path,
+                      Compression & compression,
+                      std::string & error)
+{
+    if (name == "none" || (name.empty() && !ends_with(path, ".gz")
+                                        && !ends_with(path, ".zst")))
+        compression = Compress_None;
+    else if (name == "gzip" || (name.empty() && ends_with(path, ".gz")))
+        compression = Compress_Gzip;
+    else if (name == "zstd" || name.empty())
+        compression = Compress_Zstd;
+    else {
+        error = "unknown compression " + name;
+        return false;
+    }
+#ifndef HAVE_ZSTD
+    if (compression == Compress_Zstd) {
+        error = "clang-mutate was built without zstd support";
+        return false;
+    }
+#endif
+    return true;
+}
+
+OutputFileBuf::OutputFileBuf(const std::string & path,
+                             Compression compression)
+    : m_path(path)
+    , m_file(path, std::ios::binary | std::ios::trunc)
+    , m_compressor()
+    , m_buffer(ChunkSize)
+    , m_queue()
+    , m_done(false)
+    , m_error()
+{
+    if (!m_file) {
+        m_error = "could not open " + path + " for writing";
+        return;
+    }
+    switch (compression) {
+    case Compress_Gzip:
+        m_compressor.reset(new GzipCompressor());
+        break;
+#ifdef HAVE_ZSTD
+    case Compress_Zstd:
+        m_compressor.reset(new ZstdCompressor());
+        break;
+#endif
+    default:
+        m_compressor.reset(new PlainWriter());
+        break;
+    }
+    setp(m_buffer.data(), m_buffer.data() + m_buffer.size());
+    m_writer = std::thread([this]() { run(); });
+}
+
+OutputFileBuf::~OutputFileBuf()
+{ close(); }
+
+bool OutputFileBuf::close()
+{
+    if (!m_writer.joinable())
+        return ok();
+    hand_off();
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_done = true;
+    }
+    m_changed.notify_all();
+    m_writer.join();
+    return ok();
+}
+
+OutputFileBuf::int_type OutputFileBuf::overflow(int_type c)
+{
+    hand_off();
+    if (!traits_type::eq_int_type(c, traits_type::eof())) {
+        *pptr() = traits_type::to_char_type(c);
+        pbump(1);
+    }
+    return traits_type::not_eof(c);
+}
+
+int OutputFileBuf::sync()
+{
+    hand_off();
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_error.empty() ? 0 : -1;
+}
+
+// Pass the buffered output to the writer thread, waiting for room in
+// the queue. Once writing has failed, output is dropped.
+void OutputFileBuf::hand_off()
+{
+    if (pptr() == pbase())
+        return;
+    std::string chunk(pbase(), pptr());
+    setp(m_buffer.data(), m_buffer.data() + m_buffer.size());
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_changed.wait(lock, [this]() {
+        return m_queue.size() < MaxQueued || !m_error.empty();
+    });
+    if (!m_error.empty())
+        return;
+    m_queue.push_back(std::move(chunk));
+    m_changed.notify_all();
+}
+
+void OutputFileBuf::run()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    for (;;) {
+        m_changed.wait(lock, [this]() {
+            return !m_queue.empty() || m_done;
+        });
+        if (m_queue.empty())
+            break;
+        std::string chunk = std::move(m_queue.front());
+        m_queue.pop_front();
+        m_changed.notify_all();
+
+        lock.unlock();
+        bool written = m_compressor->write(chunk.data(), chunk.size(), m_file);
+        lock.lock();
+        if (!written) {
+            m_error = "could not write " + m_path;
+            m_queue.clear();
+            m_changed.notify_all();
+            return;
+        }
+    }
+    lock.unlock();
+    bool finished = m_compressor->finish(m_file);
+    m_file.close();
+    lock.lock();
+    if (!finished || m_file.fail())
+        m_error = "could not write " + m_path;
+}
+
+} // end namespace clang_mutate
@@ -0,0 +1,78 @@
+#ifndef CLANG_MUTATE_OUTPUT_H
+#define CLANG_MUTATE_OUTPUT_H
+
+// Output to a file, optionally compressed with gzip (or with zstd, if
+// clang-mutate was built with HAVE_ZSTD). OutputFileBuf is a
+// std::streambuf, so it can stand in for std::cout's: the writer fills
+// a chunk at a time, and a thread of its own compresses and writes
+// each chunk, so that serialization and compression overlap.
+
+#include <condition_variable>
+#include <deque>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <streambuf>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace clang_mutate {
+
+enum Compression { Compress_None, Compress_Gzip, Compress_Zstd };
+
+// Parse `name` ("none", "gzip" or "zstd") into `compression`. If
+// `name` is empty, choose by the extension of `path` instead (".gz"
+// or ".zst", and no compression otherwise). On failure, returns false
+// and says why in `error`.
+bool parseCompression(const std::string & name,
+                      const std::string & path,
+                      Compression & compression,
+                      std::string & error);
+
+class Compressor;
+
+class OutputFileBuf : public std::streambuf
+{
+public:
+    // Opens `path` for writing; check ok() before use.
+    OutputFileBuf(const std::string & path, Compression compression);
+
+    // Closes the file, if close() has not been called.
+    ~OutputFileBuf();
+
+    // Once the writer thread has started, these are only meaningful
+    // after close().
+    bool ok() const { return m_error.empty(); }
+    const std::string & error() const { return m_error; }
+
+    // Write out everything given so far, finish the compressed stream
+    // and close the file. On failure, returns false and sets error().
+    bool close();
+
+protected:
+    int_type overflow(int_type c);
+    int sync();
+
+private:
+    void hand_off();
+    void run();
+
+    std::string m_path;
+    std::ofstream m_file;
+    std::unique_ptr<Compressor> m_compressor;
+    std::vector<char> m_buffer;
+
+    // Chunks waiting for the writer thread, at most a few at a time so
+    // that a slow disk holds back serialization rather than memory.
+    std::deque<std::string> m_queue;
+    std::mutex m_mutex;
+    std::condition_variable m_changed;
+    bool m_done;
+    std::string m_error;
+    std::thread m_writer;
+};
+
+} // end namespace clang_mutate
+
+#endif
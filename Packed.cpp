@@ -0,0 +1,199 @@
+#include "Packed.h"
+
+#include <string.h>
+
+namespace clang_mutate {
+
+const char * const PackedMagic = "clang-mutate packed";
+const uint64_t PackedVersion = 1;
+
+// Is `text` a list of space-separated lower-case hex pairs, as
+// binary_contents gives? Only then can it be written as raw bytes
+// and read back unchanged.
+static bool parse_hex_bytes(const std::string & text, std::string & bytes)
+{
+    static const char digits[] = "0123456789abcdef";
+    if (text.empty() || text.size() % 3 != 2)
+        return false;
+    bytes.clear();
+    for (size_t i = 0; i < text.size(); i += 3) {
+        const char * hi = strchr(digits, text[i]);
+        const char * lo = strchr(digits, text[i + 1]);
+        if (text[i] == '\0' || text[i + 1] == '\0' || !hi || !lo ||
+            (i + 2 < text.size() && text[i + 2] != ' '))
+        {
+            return false;
+        }
+        bytes.push_back(char((hi - digits) << 4 | (lo - digits)));
+    }
+    return true;
+}
+
+static std::string hex_bytes(const std::string & bytes)
+{
+    static const char digits[] = "0123456789abcdef";
+    std::string text;
+    for (unsigned char byte : bytes) {
+        if (!text.empty())
+            text.push_back(' ');
+        text.push_back(digits[byte >> 4]);
+        text.push_back(digits[byte & 0xf]);
+    }
+    return text;
+}
+
+PackedWriter::PackedWriter(std::ostream & _out)
+    : out(_out), buffer(), writer(buffer), keys()
+{
+    writer.put(std::string(PackedMagic));
+    writer.put(PackedVersion);
+    out.write(buffer.data(), buffer.size());
+    buffer.clear();
+}
+
+void PackedWriter::write(const picojson::value & record)
+{
+    put(record, "");
+    out.write(buffer.data(), buffer.size());
+    buffer.clear();
+}
+
+void PackedWriter::put_key(const std::string & key)
+{
+    auto it = keys.find(key);
+    if (it != keys.end()) {
+        writer.put(it->second + 1);
+        return;
+    }
+    uint64_t index = keys.size();
+    keys[key] = index;
+    writer.put(uint64_t(0));
+    writer.put(key);
+}
+
+// `key` is the name of the object member holding `value`, if any.
+void PackedWriter::put(const picojson::value & value, const std::string & key)
+{
+    if (value.is<picojson::null>()) {
+        writer.put(uint64_t(Packed_Null));
+    }
+    else if (value.is<bool>()) {
+        writer.put(uint64_t(value.get<bool>() ? Packed_True : Packed_False));
+    }
+    else if (value.is<int64_t>()) {
+        int64_t n = value.get<int64_t>();
+        if (n >= 0) {
+            writer.put(uint64_t(Packed_UInt));
+            writer.put(uint64_t(n));
+        }
+        else {
+            writer.put(uint64_t(Packed_NegInt));
+            writer.put(uint64_t(-(n + 1)));
+        }
+    }
+    else if (value.is<double>()) {
+        double d = value.get<double>();
+        uint64_t bits;
+        memcpy(&bits, &d, sizeof(bits));
+        writer.put(uint64_t(Packed_Double));
+        writer.put(bits);
+    }
+    else if (value.is<std::string>()) {
+        std::string bytes;
+        if (key == "binary_contents" &&
+            parse_hex_bytes(value.get<std::string>(), bytes))
+        {
+            writer.put(uint64_t(Packed_Bytes));
+            writer.put(bytes);
+        }
+        else {
+            writer.put(uint64_t(Packed_String));
+            writer.put(value.get<std::string>());
+        }
+    }
+    else if (value.is<picojson::array>()) {
+        const picojson::array & array = value.get<picojson::array>();
+        writer.put(uint64_t(Packed_Array));
+        writer.put(uint64_t(array.size()));
+        for (auto & item : array)
+            put(item, "");
+    }
+    else {
+        const picojson::object & object = value.get<picojson::object>();
+        writer.put(uint64_t(Packed_Object));
+        writer.put(uint64_t(object.size()));
+        for (auto & member : object) {
+            put_key(member.first);
+            put(member.second, member.first);
+        }
+    }
+}
+
+PackedReader::PackedReader(const std::string & in)
+    : reader(in), failed(false), keys()
+{
+    failed = reader.get_string() != PackedMagic
+          || reader.get_uint() != PackedVersion;
+}
+
+bool PackedReader::next(picojson::value & record)
+{
+    if (!ok() || reader.done())
+        return false;
+    record = get();
+    return ok();
+}
+
+picojson::value PackedReader::get()
+{
+    switch (reader.get_uint()) {
+    case Packed_Null:
+        return picojson::value();
+    case Packed_False:
+        return picojson::value(false);
+    case Packed_True:
+        return picojson::value(true);
+    case Packed_UInt:
+        return picojson::value(int64_t(reader.get_uint()));
+    case Packed_NegInt:
+        return picojson::value(-int64_t(reader.get_uint()) - 1);
+    case Packed_Double: {
+        uint64_t bits = reader.get_uint();
+        double d;
+        memcpy(&d, &bits, sizeof(d));
+        return picojson::value(d);
+    }
+    case Packed_String:
+        return picojson::value(reader.get_string());
+    case Packed_Bytes:
+        return picojson::value(hex_bytes(reader.get_string()));
+    case Packed_Array: {
+        picojson::array array;
+        for (uint64_t n = reader.get_uint(); n > 0 && ok(); --n)
+            array.push_back(get());
+        return picojson::value(array);
+    }
+    case Packed_Object: {
+        picojson::object object;
+        for (uint64_t n = reader.get_uint(); n > 0 && ok(); --n) {
+            uint64_t k = reader.get_uint();
+            if (k == 0) {
+                keys.push_back(reader.get_string());
+                k = keys.size();
+            }
+            if (k > keys.size()) {
+                failed = true;
+                break;
+            }
+            std::string key = keys[k - 1];
+            object[key] = get();
+        }
+        return picojson::value(object);
+    }
+    default:
+        failed = true;
+        return picojson::value();
+    }
+}
+
+} // end namespace clang_mutate
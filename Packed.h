@@ -0,0 +1,99 @@
+#ifndef CLANG_MUTATE_PACKED_H
+#define CLANG_MUTATE_PACKED_H
+
+// A compact binary encoding of clang-mutate's JSON output, for
+// consumers which would rather not parse text. A stream holds the
+// same records as `json` prints (aux entries, then ASTs), each one
+// decoding to exactly the JSON value it stands for.
+//
+// A stream begins with PackedMagic (as a string) and a varint format
+// version, and is followed by the records until end of input.
+// Integers are LEB128 varints (as in Serialization.h); each value is
+// a varint tag and then its payload:
+//
+//   Null, False, True          no payload
+//   UInt                       varint
+//   NegInt                     varint holding -(n + 1)
+//   Double                     varint holding the IEEE 754 bits
+//   String                     varint length, then the bytes
+//   Bytes                      varint length, then the raw bytes;
+//                              decodes to a string of space-separated
+//                              hex pairs (as in binary_contents)
+//   Array                      varint length, then the values
+//   Object                     varint length, then key/value pairs
+//
+// Object keys form a dictionary built up as the stream is read: a key
+// is written as varint 0 and its name the first time it is used, and
+// as varint (k + 1) thereafter, where k counts the names defined
+// before it.
+//
+// The reader depends only on picojson and Serialization.h, so that it
+// can be used without linking clang.
+
+#include "Json.h"
+#include "Serialization.h"
+
+#include <map>
+#include <ostream>
+#include <string>
+#include <vector>
+
+namespace clang_mutate {
+
+extern const char * const PackedMagic;
+extern const uint64_t PackedVersion;
+
+enum PackedTag { Packed_Null
+               , Packed_False
+               , Packed_True
+               , Packed_UInt
+               , Packed_NegInt
+               , Packed_Double
+               , Packed_String
+               , Packed_Bytes
+               , Packed_Array
+               , Packed_Object
+};
+
+class PackedWriter
+{
+public:
+    // Writes the stream header to `out`.
+    PackedWriter(std::ostream & out);
+
+    void write(const picojson::value & record);
+
+private:
+    void put(const picojson::value & value, const std::string & key);
+    void put_key(const std::string & key);
+
+    std::ostream & out;
+    std::string buffer;
+    BinaryWriter writer;
+    std::map<std::string, uint64_t> keys;
+};
+
+class PackedReader
+{
+public:
+    // Reads the stream header from `in`, which must outlive the reader.
+    PackedReader(const std::string & in);
+
+    // False if the header was bad, or a record was cut short.
+    bool ok() const { return !failed && !reader.fail(); }
+
+    // Read the next record into `record`, returning false at the end
+    // of the stream or on a malformed record.
+    bool next(picojson::value & record);
+
+private:
+    picojson::value get();
+
+    BinaryReader reader;
+    bool failed;
+    std::vector<std::string> keys;
+};
+
+} // end namespace clang_mutate
+
+#endif
@@ -109,14 +109,22 @@ struct interactive_op
         , set_op
         , clear_op
         , reset_op
+        , snapshot_op
+        , restore_op
+        , fork_op
         , print_op
         , preview_op
+        , diff_op
+        , fingerprint_op
+        , reparse_op
+        , apply_diff_op
         , info_op
         , types_op
         , echo_op
         , binary_op
         , llvm_ir_op
         , ids_op
+        , memory_op
         , annotate_op
         , number_op
         , number_full_op
@@ -131,6 +139,11 @@ struct interactive_op
         , aux_op
         , ast_op
         , json_op
+        , jsonl_op
+        , packed_op
+        , json_delta_op
+        , columns_op
+        , batch_op
         , sexp_op
         , load_op
         , unload_op
@@ -21,6 +21,11 @@ public:
 
     PTNode position() const;
     void moveTo(PTNode node);
+
+    // Direct access to the nodes, without moving the point.
+    const T & at(PTNode node) const;
+    PTNode parentOf(PTNode node) const;
+    PTNode add(const T& x, PTNode parent);
     
     std::vector<T> spine() const;
     std::vector<T> spineFrom(PTNode node) const;
@@ -37,6 +42,13 @@ public:
         PTNode point;
     };
     PointedTreeSnapshot snapshot();
+
+    // Serialize the tree's shape and point, using write_datum and
+    // read_datum for the data at each node.
+    template <typename Writer, typename F>
+    void write(Writer & out, F write_datum) const;
+    template <typename Reader, typename F>
+    void read(Reader & in, F read_datum);
     
 private:
     struct TreeNode
@@ -55,6 +67,32 @@ template <typename T>
 typename PointedTree<T>::PointedTreeSnapshot PointedTree<T>::snapshot()
 { return PointedTreeSnapshot(*this); }
 
+template <typename T>
+template <typename Writer, typename F>
+void PointedTree<T>::write(Writer & out, F write_datum) const
+{
+    out.put(uint64_t(m_nodes.size()));
+    for (auto & node : m_nodes) {
+        write_datum(out, node.datum);
+        out.put(uint64_t(node.parent + 1));
+    }
+    out.put(uint64_t(m_point + 1));
+}
+
+template <typename T>
+template <typename Reader, typename F>
+void PointedTree<T>::read(Reader & in, F read_datum)
+{
+    m_nodes.clear();
+    size_t n = in.get_uint();
+    for (size_t i = 0; i < n && !in.fail(); ++i) {
+        T datum = read_datum(in);
+        PTNode parent = PTNode(in.get_uint()) - 1;
+        m_nodes.push_back(TreeNode(datum, parent));
+    }
+    m_point = PTNode(in.get_uint()) - 1;
+}
+
 template <typename T> bool PointedTree<T>::isEmpty() const
 { return m_nodes.empty() || m_point == NoNode; }
 
@@ -69,6 +107,18 @@ template <typename T> PTNode PointedTree<T>::position() const
 
 template <typename T> void PointedTree<T>::moveTo(PTNode node)
 { m_point = node; }
+
+template <typename T> const T & PointedTree<T>::at(PTNode node) const
+{ return m_nodes[node].datum; }
+
+template <typename T> PTNode PointedTree<T>::parentOf(PTNode node) const
+{ return m_nodes[node].parent; }
+
+template <typename T> PTNode PointedTree<T>::add(const T& x, PTNode parent)
+{
+    m_nodes.push_back(TreeNode(x, parent));
+    return m_nodes.size() - 1;
+}
       
 template <typename T> void PointedTree<T>::push(const T& x)
 {
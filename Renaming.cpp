@@ -3,6 +3,7 @@
 #include "Utils.h"
 #include "clang/Lex/Lexer.h"
 
+#include <algorithm>
 #include <sstream>
 #include <iostream>
 
@@ -19,45 +20,14 @@ RenameDatum mkFunctionRename(
     const std::string & name)
 { return RenameDatum(id, name, 0, FunctionRename); }
 
-RenameFreeVar::RenameFreeVar(
-    Stmt * the_stmt,
-    SourceManager & _sm,
-    const LangOptions & _langOpts,
-    SourceLocation _begin,
-    SourceLocation _end,
-    const Renames & rn)
-    : sm(_sm)
-    , langOpts(_langOpts)
-    , begin(_begin)
-    , end(_end)
-    , renames(rn)
-{
-    TraverseStmt(the_stmt);
-}
-
-RenameFreeVar::RenameFreeVar(
-    Decl * the_decl,
-    SourceManager & _sm,
-    const LangOptions & _langOpts,
-    SourceLocation _begin,
-    SourceLocation _end,
-    const Renames & rn)
-    : sm(_sm)
-    , langOpts(_langOpts)
-    , begin(_begin)
-    , end(_end)
-    , renames(rn)
-{
-    TraverseDecl(the_decl);
-}
-
-static bool find_identifier(const Renames & renames,
-                            IdentifierInfo * id,
+static bool find_identifier(const std::set<VariableInfo> & vars,
+                            const std::set<FunctionInfo> & funs,
+                            const IdentifierInfo * id,
                             std::string & ans)
 {
     std::ostringstream oss;
     for (std::set<VariableInfo>::const_iterator
-             it = renames.first.begin(); it != renames.first.end(); ++it)
+             it = vars.begin(); it != vars.end(); ++it)
     {
         if (it->getId() == id) {
             oss << "(|" << it->getName() << "|)";
@@ -66,7 +36,7 @@ static bool find_identifier(const Renames & renames,
         }
     }
     for (std::set<FunctionInfo>::const_iterator
-             it = renames.second.begin(); it != renames.second.end(); ++it)
+             it = funs.begin(); it != funs.end(); ++it)
     {
         if (it->getId() == id) {
             oss << "(|" << it->getName() << "|)";
@@ -77,118 +47,176 @@ static bool find_identifier(const Renames & renames,
     return false;
 }
 
-bool getRangeSize(const CharSourceRange & r,
-                  const SourceManager & sm,
-                  const LangOptions & langOpts,
-                  int & result)
+void RenameTable::add(DeclRefExpr * declref,
+                      SourceManager & sm,
+                      const LangOptions & langOpts)
 {
-    SourceLocation sp_begin = sm.getSpellingLoc(r.getBegin());
-    SourceLocation sp_end   = sm.getSpellingLoc(r.getEnd());
-    std::pair<FileID, unsigned> begin = sm.getDecomposedLoc(sp_begin);
-    std::pair<FileID, unsigned> end   = sm.getDecomposedLoc(sp_end);
-    if (begin.first != end.first)
-        return false;
-    if (r.isTokenRange())
-        end.second += Lexer::MeasureTokenLength(sp_end, sm, langOpts);
-    result = end.second - begin.second;
-    return true;
-}
+    IdentifierInfo * id = declref->getDecl()->getIdentifier();
+    if (id == NULL)
+        return;
 
-bool RenameFreeVar::VisitStmt(Stmt * stmt)
-{
-  if (isa<DeclRefExpr>(stmt)) {
-    DeclRefExpr * declref = static_cast<DeclRefExpr*>(stmt);
-    ValueDecl * vdecl     = declref->getDecl();
-    IdentifierInfo * id   = vdecl->getIdentifier();
-    std::string name;
-    if (id != NULL && find_identifier(renames, id, name)) {
-      SourceRange sr =
-          Utils::getImmediateMacroArgCallerRange(
-              sm,
-              stmt->getSourceRange());
-      // Use spelling location to correctly handle macro expansions
-      SourceLocation stmt_begin = sm.getSpellingLoc(sr.getBegin());
-
-      if (sm.isInMainFile(sr.getBegin()) &&
-          !sm.isMacroBodyExpansion(sr.getBegin()))
-      {
-        // Not very efficient, but I didn't see a better way to
-        // get the size in characters of a CharSourceRange.
-        CharSourceRange srcRange =
-            CharSourceRange::getCharRange(begin, stmt_begin);
-        size_t offset = Lexer::getSourceText(
-            srcRange,
+    SourceRange sr =
+        Utils::getImmediateMacroArgCallerRange(
             sm,
-            langOpts,
-            NULL).size();
-        std::string old_str;
-        llvm::raw_string_ostream ss(old_str);
-        stmt->printPretty(ss, 0, PrintingPolicy(langOpts));
-        old_str = ss.str();
-        std::string new_str = name;
-
-        int _;
-        // If the statement is part of a macro expansion, getRangeSize will
-        // return false; we want to skip the rewriting in this case.
-        if (getRangeSize(srcRange, sm, langOpts, _)) {
-            replacements.add(offset, old_str, new_str);
-        }
-      }
+            declref->getSourceRange());
+    if (!sm.isInMainFile(sr.getBegin()) ||
+        sm.isMacroBodyExpansion(sr.getBegin()))
+    {
+        return;
     }
-  }
-  return true;
+
+    // Use spelling location to correctly handle macro expansions.
+    // If the reference is spelled outside of the main file, it
+    // cannot be rewritten.
+    std::pair<FileID, unsigned> decomp =
+        sm.getDecomposedLoc(sm.getSpellingLoc(sr.getBegin()));
+    if (decomp.first != sm.getMainFileID())
+        return;
+
+    std::string old_str;
+    llvm::raw_string_ostream ss(old_str);
+    declref->printPretty(ss, 0, PrintingPolicy(langOpts));
+    sites.push_back(RenameSite(decomp.second, id, ss.str()));
 }
 
-std::string RenameFreeVar::getRewrittenString() const
+void RenameTable::finalize()
 {
-    std::string orig = Lexer::getSourceText(
-        CharSourceRange::getCharRange(begin, end),
-        sm,
-        langOpts,
-        NULL);
-    return replacements.apply_to(orig);
+    // The traversal visits references nearly in source order, so
+    // this is cheap. A reference visited twice (e.g. through both
+    // forms of an InitListExpr) is only kept once.
+    std::stable_sort(sites.begin(), sites.end());
+    sites.erase(std::unique(sites.begin(), sites.end(),
+                            [](const RenameSite & a, const RenameSite & b)
+                            { return a.offset == b.offset; }),
+                sites.end());
 }
 
-std::set<std::string> RenameFreeVar::getIncludes() const
-{ return includes; }
+Replacements RenameTable::slice(size_t base, size_t begin, size_t end) const
+{
+    RenameSite lo(begin, NULL, "");
+    RenameSite hi(end, NULL, "");
+    auto first = std::lower_bound(sites.begin(), sites.end(), lo);
+    auto last = std::upper_bound(first, sites.end(), hi);
+    return Replacements(base,
+                        first - sites.begin(),
+                        last - sites.begin());
+}
+
+void RenameTable::splice(const RenameTable & other,
+                         size_t begin, size_t end, size_t other_end,
+                         long & moved, long & moved_other)
+{
+    RenameSite lo(begin, NULL, "");
+    auto first = std::lower_bound(sites.begin(), sites.end(), lo);
+    auto last = std::upper_bound(first, sites.end(),
+                                 RenameSite(end, NULL, ""));
+    auto other_first = std::lower_bound(other.sites.begin(),
+                                        other.sites.end(), lo);
+    auto other_last = std::upper_bound(other_first, other.sites.end(),
+                                       RenameSite(other_end, NULL, ""));
+
+    moved = (other_last - other_first) - (last - first);
+    moved_other = (first - sites.begin()) - (other_first - other.sites.begin());
+
+    std::vector<RenameSite> after(last, sites.end());
+    sites.erase(first, sites.end());
+    sites.insert(sites.end(), other_first, other_last);
+    for (auto & site : after) {
+        site.offset = site.offset + other_end - end;
+        sites.push_back(site);
+    }
+}
 
-void Replacements::add(size_t offset,
-                       const std::string & old_str,
-                       const std::string & new_str)
+Replacements Replacements::moved(long sites, long offset) const
 {
-    replacements[offset] = std::make_pair(old_str, new_str);
+    if (first == last)
+        return *this;
+    return Replacements(base + offset, first + sites, last + sites);
 }
 
-std::string Replacements::apply_to(const std::string & orig) const
+std::string Replacements::apply_to(const std::string & orig,
+                                   const RenameTable & table,
+                                   const std::set<VariableInfo> & vars,
+                                   const std::set<FunctionInfo> & funs) const
 {
     std::string ans;
-    auto it = replacements.begin();
-    for (size_t p = 0; p < orig.size(); ++p) {
-        if (it != replacements.end() && p == it->first) {
-            std::string old = it->second.first;
-            // Make sure we're replacing what we think we're replacing.
-
-            // In some cases, ASTs which are generated by a macro body are
-            // misidentified as originating from the macro arguments, and we
-            // try to rename a free variable that doesn't exist in the source
-            // text. This seems to be a clang problem. We can work around it
-            // by skipping the replacement when the original text doesn't
-            // match the string we want to replace.
-
-            // See test/replace-var-in-macro for a case that requires this
-            // workaround.
-
-            if (orig.compare(p, old.size(), old) == 0) {
-                p += old.size() - 1; // - 1 compensates ++p
-                ans.append(it->second.second);
-            }
-            else {
-                ans.push_back(orig[p]);
-            }
-            ++it;
+    std::string new_str;
+    size_t p = 0;
+    for (size_t i = first; i < last; ++i) {
+        const RenameSite & site = table[i];
+        if (site.offset < base + p)
+            continue;
+        size_t q = site.offset - base;
+        if (q >= orig.size())
+            break;
+        if (!find_identifier(vars, funs, site.ident, new_str))
             continue;
+
+        ans.append(orig, p, q - p);
+        p = q;
+
+        // Make sure we're replacing what we think we're replacing.
+
+        // In some cases, ASTs which are generated by a macro body are
+        // misidentified as originating from the macro arguments, and we
+        // try to rename a free variable that doesn't exist in the source
+        // text. This seems to be a clang problem. We can work around it
+        // by skipping the replacement when the original text doesn't
+        // match the string we want to replace.
+
+        // See test/replace-var-in-macro for a case that requires this
+        // workaround.
+
+        if (orig.compare(q, site.old_str.size(), site.old_str) == 0) {
+            ans.append(new_str);
+            p += site.old_str.size();
         }
-        ans.push_back(orig[p]);
     }
+    ans.append(orig, p, std::string::npos);
     return ans;
 }
+
+void Replacements::write(clang_mutate::BinaryWriter & out) const
+{
+    out.put(uint64_t(base));
+    out.put(uint64_t(first));
+    out.put(uint64_t(last));
+}
+
+Replacements Replacements::read(clang_mutate::BinaryReader & in)
+{
+    size_t base = in.get_uint();
+    size_t first = in.get_uint();
+    size_t last = in.get_uint();
+    return Replacements(base, first, last);
+}
+
+void RenameTable::collectIdentifiers(
+    std::set<const IdentifierInfo*> & ids) const
+{
+    for (auto & site : sites)
+        if (site.ident != NULL)
+            ids.insert(site.ident);
+}
+
+void RenameTable::write(clang_mutate::BinaryWriter & out) const
+{
+    out.put(uint64_t(sites.size()));
+    for (auto & site : sites) {
+        out.put(uint64_t(site.offset));
+        out.put(site.ident);
+        out.put(site.old_str);
+    }
+}
+
+void RenameTable::read(clang_mutate::BinaryReader & in)
+{
+    sites.clear();
+    size_t n = in.get_uint();
+    for (size_t i = 0; i < n && !in.fail(); ++i) {
+        size_t offset = in.get_uint();
+        const IdentifierInfo * ident = in.get_identifier();
+        std::string old_str = in.get_string();
+        sites.push_back(RenameSite(offset, ident, old_str));
+    }
+}
@@ -16,6 +16,7 @@
 #include <string>
 #include <set>
 #include <map>
+#include <vector>
 
 // Enable the following macro to rewrite free function
 // names; without this macro, function names will just
@@ -23,13 +24,95 @@
 // do substitution.
 //#define ALLOW_FREE_FUNCTIONS
 
+class RenameTable;
+
+// The free identifier references within one AST: a slice of its TU's
+// RenameTable, along with the offset at which the AST's text begins.
 class Replacements
 {
 public:
-    void add(size_t offset, const std::string & old_str, const std::string & new_str);
-    std::string apply_to(const std::string & input) const;
+    Replacements() : base(0), first(0), last(0) {}
+    Replacements(size_t _base, size_t _first, size_t _last)
+        : base(_base), first(_first), last(_last) {}
+
+    // Replace each reference to one of the given free variables or
+    // functions in `input` (the text of the AST) by (|name|).
+    std::string apply_to(const std::string & input,
+                         const RenameTable & table,
+                         const std::set<VariableInfo> & vars,
+                         const std::set<FunctionInfo> & funs) const;
+
+    size_t size() const { return last - first; }
+
+    // The same references, after `sites` sites have been inserted
+    // into the table before them and `offset` characters into the
+    // text before the AST.
+    Replacements moved(long sites, long offset) const;
+
+    void write(clang_mutate::BinaryWriter & out) const;
+    static Replacements read(clang_mutate::BinaryReader & in);
 private:
-    std::map<size_t, std::pair<std::string, std::string> > replacements;
+    size_t base;
+    size_t first;
+    size_t last;
+};
+
+// One reference to a named declaration, at an offset into the main file.
+struct RenameSite
+{
+    RenameSite(size_t o,
+               const clang::IdentifierInfo * id,
+               const std::string & str)
+        : offset(o), ident(id), old_str(str) {}
+
+    size_t offset;
+    const clang::IdentifierInfo * ident;
+    std::string old_str;
+
+    bool operator<(const RenameSite & that) const
+    { return offset < that.offset; }
+};
+
+// Every renameable reference in a TU, gathered in a single pass while
+// the TU is built and then sorted by offset, so that the references
+// within any AST form a contiguous slice.
+class RenameTable
+{
+public:
+    void add(clang::DeclRefExpr * declref,
+             clang::SourceManager & sm,
+             const clang::LangOptions & langOpts);
+
+    // Sort the sites by offset; must be called after the last add()
+    // and before any call to slice().
+    void finalize();
+
+    // The sites with offsets in [begin, end], relative to base.
+    Replacements slice(size_t base, size_t begin, size_t end) const;
+
+    const RenameSite & operator[](size_t i) const
+    { return sites[i]; }
+
+    size_t size() const { return sites.size(); }
+
+    // Replace the sites with offsets in [begin, end] by the sites of
+    // `other` with offsets in [begin, other_end], and move the sites
+    // after `end` by other_end - end. On return, `moved` is the number
+    // of sites inserted before the sites which followed `end`, and
+    // `moved_other` the number inserted before those taken from
+    // `other` (both for use with Replacements::moved).
+    void splice(const RenameTable & other,
+                size_t begin, size_t end, size_t other_end,
+                long & moved, long & moved_other);
+
+    // Every identifier referenced by the table, for use with
+    // BinaryWriter::setIdentifiers.
+    void collectIdentifiers(std::set<const clang::IdentifierInfo*> & ids) const;
+
+    void write(clang_mutate::BinaryWriter & out) const;
+    void read(clang_mutate::BinaryReader & in);
+private:
+    std::vector<RenameSite> sites;
 };
 
 enum RenameKind
@@ -75,44 +158,4 @@ RenameDatum mkFunctionRename(
 typedef std::pair<std::set<VariableInfo>,
                   std::set<FunctionInfo> > Renames;
 
-class RenameFreeVar
-  : public clang::RecursiveASTVisitor<RenameFreeVar>
-  , public clang::ASTConsumer
-{
-public:
-  typedef clang::RecursiveASTVisitor<RenameFreeVar> Base;
-  
-  RenameFreeVar(clang::Stmt * the_stmt,
-                clang::SourceManager & _sm,
-                const clang::LangOptions & _langOpts,
-                clang::SourceLocation _begin,
-                clang::SourceLocation _end,
-                const Renames & renames);
-
-  RenameFreeVar(clang::Decl * the_decl,
-                clang::SourceManager & _sm,
-                const clang::LangOptions & _langOpts,
-                clang::SourceLocation _begin,
-                clang::SourceLocation _end,
-                const Renames & renames);
-
-  bool VisitStmt(clang::Stmt * stmt);
-
-  std::string getRewrittenString() const;
-
-  std::set<std::string> getIncludes() const;
-
-  Replacements getReplacements() const
-  { return replacements; }
-  
-private:
-  clang::SourceManager & sm;
-  const clang::LangOptions & langOpts;
-  clang::SourceLocation begin;
-  clang::SourceLocation end;
-  const Renames & renames;
-  Replacements replacements;
-  std::set<std::string> includes;
-};
-
 #endif
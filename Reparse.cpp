@@ -0,0 +1,294 @@
+#include "Reparse.h"
+#include "Macros.h"
+
+#include "clang/Frontend/CompilerInstance.h"
+#include "clang/Frontend/FrontendAction.h"
+#include "llvm/Support/MemoryBuffer.h"
+
+#include <algorithm>
+#include <memory>
+
+namespace clang_mutate {
+using namespace clang;
+
+namespace {
+
+class ReparseAction : public ASTFrontendAction
+{
+public:
+    ReparseAction(bool _with_cfg, SourceOffset _keep_body)
+        : with_cfg(_with_cfg), keep_body(_keep_body)
+    {}
+
+    std::unique_ptr<ASTConsumer>
+    CreateASTConsumer(CompilerInstance & CI, StringRef) override
+    { return CreateTU(&CI, with_cfg, keep_body); }
+
+private:
+    bool with_cfg;
+    SourceOffset keep_body;
+};
+
+// The Asts of a TU which is not (or not yet) in TUs, where AstRefs
+// cannot be followed.
+Ast & ast_in(const TU & tu, AstCounter counter)
+{ return *tu.asts[counter - 1]; }
+
+// Build a TU with the same id as `tu` from `text`, using the compiler
+// invocation which built `tu`. If `keep_body` is a valid offset, the
+// bodies of all functions except the one which begins there are
+// skipped. The new TU stands in for `tu` in TUs only while it is being
+// built. Returns NULL if the TU cannot be rebuilt; `clean` says whether
+// clang reported any errors.
+TU * build(TU & tu,
+           const std::string & text,
+           SourceOffset keep_body,
+           bool & clean)
+{
+    auto invocation = std::make_shared<CompilerInvocation>(*tu.invocation);
+    FrontendOptions & opts = invocation->getFrontendOpts();
+    if (opts.Inputs.size() != 1 || !opts.Inputs[0].isFile())
+        return NULL;
+
+    std::string main_file = opts.Inputs[0].getFile();
+    opts.SkipFunctionBodies = (keep_body != BadOffset);
+    invocation->getFileSystemOpts().WorkingDir = tu.directory;
+    invocation->getPreprocessorOpts().addRemappedFile(
+        main_file,
+        llvm::MemoryBuffer::getMemBufferCopy(text, main_file).release());
+    invocation->getPreprocessorOpts().RetainRemappedFileBuffers = false;
+
+    CompilerInstance * ci = new CompilerInstance;
+    ci->setInvocation(invocation);
+    ci->createDiagnostics();
+    ci->createFileManager();
+    ci->createSourceManager(ci->getFileManager());
+
+    TU * rebuilt = new TU(tu.tuid, ci);
+    rebuilt->invocation = tu.invocation;
+    rebuilt->directory = tu.directory;
+
+    TU * previous = tu_in_progress;
+    tu_in_progress = rebuilt;
+    registerTU(rebuilt);
+    {
+        ReparseAction action(tu.with_cfg, keep_body);
+        clean = ci->ExecuteAction(action);
+    }
+    rebuilt->detach();
+    registerTU(&tu);
+    tu_in_progress = previous;
+
+    return rebuilt;
+}
+
+// The body of the top-level function whose body holds every
+// difference between the TU's source and `text`, or NoAst if there is
+// no such function.
+AstRef changed_body(const TU & tu, const std::string & text)
+{
+    const std::string & source = tu.source;
+    size_t limit = std::min(source.size(), text.size());
+    size_t prefix = 0;
+    while (prefix < limit && source[prefix] == text[prefix])
+        ++prefix;
+    size_t suffix = 0;
+    while (suffix < limit - prefix &&
+           source[source.size() - 1 - suffix] == text[text.size() - 1 - suffix])
+    {
+        ++suffix;
+    }
+
+    // The edit replaced [prefix, old_end) in the source by
+    // [prefix, new_end) in `text`. A preprocessor directive there could
+    // change how everything after it is parsed.
+    size_t old_end = source.size() - suffix;
+    size_t new_end = text.size() - suffix;
+    if (std::find(source.begin() + prefix, source.begin() + old_end, '#')
+            != source.begin() + old_end ||
+        std::find(text.begin() + prefix, text.begin() + new_end, '#')
+            != text.begin() + new_end)
+    {
+        return NoAst;
+    }
+
+    for (auto & entry : tu.function_starts) {
+        AstRef body = entry.first;
+        if (body->parent()->parent() != NoAst ||
+            body->initial_offset() == BadOffset ||
+            body->final_offset() == BadOffset)
+        {
+            continue;
+        }
+        // Strictly inside the braces, so that the function's
+        // signature (and so everything after it) is unaffected.
+        if (SourceOffset(prefix) > body->initial_offset() &&
+            SourceOffset(old_end) <= body->final_offset())
+        {
+            return body;
+        }
+    }
+    return NoAst;
+}
+
+// Rebuild the function with body `body` from `text`, and splice it
+// into the TU. Returns false, leaving the TU unchanged, if the new
+// function could not be matched up with the old one.
+bool splice(TU & tu, AstRef body, const std::string & text, long & shift)
+{
+    AstRef decl = body->parent();
+    SourceOffset start = tu.function_starts[body];
+
+    bool clean;
+    std::unique_ptr<TU> scratch(build(tu, text, start, clean));
+    if (!scratch || !clean)
+        return false;
+
+    AstRef new_body = NoAst;
+    for (auto & entry : scratch->function_starts) {
+        if (entry.second == start)
+            new_body = entry.first;
+    }
+    if (new_body == NoAst)
+        return false;
+
+    long text_shift = long(text.size()) - long(tu.source.size());
+    AstCounter new_first = ast_in(*scratch, new_body.counter()).parent().counter();
+    Ast & new_decl = ast_in(*scratch, new_first);
+    if (new_decl.parent() != NoAst ||
+        new_decl.initial_offset() != decl->initial_offset() ||
+        new_decl.final_offset() != decl->final_offset() + text_shift)
+    {
+        return false;
+    }
+
+    AstCounter first = decl.counter();
+    AstCounter last = decl->exit_index();
+    AstCounter new_last = new_decl.exit_index();
+    shift = long(new_last - new_first) - long(last - first);
+
+    // The new function's Asts take the place of the old ones, and the
+    // Asts after them move along.
+    AstShift inner;
+    inner.counters = long(first) - long(new_first);
+    AstShift after;
+    after.counters = shift;
+    after.offsets = text_shift;
+    after.from = decl->end_src_pos();
+    after.to = new_decl.end_src_pos();
+
+    tu.renames.splice(scratch->renames,
+                      decl->initial_offset(),
+                      decl->final_offset(),
+                      new_decl.final_offset(),
+                      after.sites,
+                      inner.sites);
+
+    // The scopes enclosing the function are the same in both TUs.
+    std::map<PTNode, PTNode> imported;
+    imported[new_decl.scopePosition()] = decl->scopePosition();
+
+    Arena<Ast> arena;
+    std::vector<Ast*> asts;
+    for (AstCounter c = 1; c < first; ++c)
+        asts.push_back(arena.create(std::move(ast_in(tu, c))));
+    for (AstCounter c = new_first; c <= new_last; ++c) {
+        Ast * ast = arena.create(std::move(ast_in(*scratch, c)));
+        ast->relocate(inner);
+        ast->setScopePosition(tu.scopes.import(scratch->scopes,
+                                               ast->scopePosition(),
+                                               imported,
+                                               inner.counters));
+        asts.push_back(ast);
+    }
+    for (AstCounter c = last + 1; c <= tu.asts.size(); ++c) {
+        Ast * ast = arena.create(std::move(ast_in(tu, c)));
+        ast->relocate(after);
+        asts.push_back(ast);
+    }
+    tu.ast_arena.swap(arena);
+    tu.asts.swap(asts);
+
+    std::map<AstRef, SourceOffset> starts;
+    for (auto & entry : tu.function_starts) {
+        if (entry.first.counter() < first)
+            starts[entry.first] = entry.second;
+        else if (entry.first.counter() > last)
+            starts[after.apply(entry.first)] = after.apply(entry.second);
+    }
+    starts[inner.apply(new_body)] = start;
+    tu.function_starts.swap(starts);
+    for (auto it = tu.function_starts.lower_bound(decl);
+         it != tu.function_starts.end();
+         ++it)
+    {
+        AuxDBEntry & proto = it->first->parent()->aux();
+        proto.set("body", it->first);
+        proto.set("stmt_range", it->first->stmt_range());
+    }
+
+    tu.source = text;
+    tu.source_hashes.reset();
+    tu.aux["decls"] = scratch->aux["decls"];
+    tu.type_hashes.insert(scratch->type_hashes.begin(),
+                          scratch->type_hashes.end());
+    tu.macros = scratch->macros;
+    return true;
+}
+
+} // end namespace
+
+bool reparseTU(TURef tuid,
+               const std::string & text,
+               picojson::value & summary,
+               std::string & error)
+{
+    TU * tu = TUs.at(tuid);
+    if (!tu->invocation) {
+        error = "this translation unit was loaded from the cache, "
+                "and cannot be reparsed";
+        return false;
+    }
+
+    bool full = false;
+    std::vector<AstRef> functions;
+    long shift = 0;
+
+    if (text != tu->source) {
+        AstRef body = changed_body(*tu, text);
+        AstRef decl = body == NoAst ? NoAst : body->parent();
+        if (body != NoAst && splice(*tu, body, text, shift)) {
+            functions.push_back(decl);
+        }
+        else {
+            bool clean;
+            TU * rebuilt = build(*tu, text, BadOffset, clean);
+            if (rebuilt == NULL) {
+                error = "the compiler invocation for this translation "
+                        "unit cannot be reused";
+                return false;
+            }
+            // As when splicing, an edit which does not compile leaves
+            // the TU as it was.
+            if (!clean) {
+                delete rebuilt;
+                error = "the modified source does not compile";
+                return false;
+            }
+            registerTU(rebuilt);
+            if (tu_in_progress == tu)
+                tu_in_progress = rebuilt;
+            delete tu;
+            full = true;
+        }
+    }
+
+    std::map<std::string, picojson::value> ans;
+    ans["full"] = to_json(full);
+    ans["functions"] = to_json(functions);
+    ans["shift"] = to_json(int64_t(shift));
+    summary = to_json(ans);
+    return true;
+}
+
+} // end namespace clang_mutate
@@ -0,0 +1,35 @@
+#ifndef CLANG_MUTATE_REPARSE_H
+#define CLANG_MUTATE_REPARSE_H
+
+// Rebuilding a TU from an edited version of its source, without going
+// through a file on disk.
+//
+// When the edit falls within the body of a single top-level function,
+// only that function is rebuilt: clang skips the bodies of all other
+// functions, and the new function's Asts are spliced into the TU in
+// place of the old ones. Every other Ast keeps its traits, type
+// hashes and aux entries; the counters and source positions of those
+// after the function are moved to account for the edit. Any other
+// edit rebuilds the whole TU, as if it had been loaded afresh. Either
+// way, an edit after which clang reports errors is not taken.
+
+#include "TU.h"
+#include "Json.h"
+
+#include <string>
+
+namespace clang_mutate {
+
+// Rebuild the TU `tuid` from `text`. On success, `summary` says
+// whether the whole TU was rebuilt ("full"), which function decls were
+// rebuilt ("functions"), and how far the counters of the Asts after
+// them moved ("shift"). On failure, the TU is unchanged and `error`
+// says why.
+bool reparseTU(TURef tuid,
+               const std::string & text,
+               picojson::value & summary,
+               std::string & error);
+
+} // end namespace clang_mutate
+
+#endif
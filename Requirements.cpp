@@ -22,7 +22,8 @@ Requirements::Requirements(
     , ci(_ci)
     , m_ast_context(astContext)
     , m_syn_ctx(_sctx)
-    , m_vars(), m_funs(), m_includes(), m_macros(), m_addl_types()
+    , m_vars(), m_funs(), m_includes(), m_header_refs()
+    , m_macros(), m_addl_types()
     , m_parent(NoAst), m_scope_pos(NoNode)
     , toplev_is_macro(false)
     , is_first(true)
@@ -75,7 +76,9 @@ bool Requirements::VisitDeclRefExpr(DeclRefExpr * expr)
     if (id != NULL && !ctx.is_bound(name) && !isMacro) {
         std::string header;
         if (Utils::in_header(vdecl->getLocation(), ci, header)) {
-            m_includes.insert(header);
+            // Remember which name needed the header, in case an
+            // enclosing context turns out to bind it.
+            m_header_refs.insert(std::make_pair(name, header));
         }
         else if (isa<FunctionDecl>(vdecl)) {
             m_funs.insert(
@@ -104,6 +107,29 @@ bool Requirements::VisitExplicitCastExpr(
     return base::VisitExplicitCastExpr(expr);
 }
 
+void Requirements::merge(const Requirements & child)
+{
+    for (auto & var : child.m_vars) {
+        if (!ctx.is_bound(var.first))
+            m_vars.insert(var);
+    }
+    for (auto & fun : child.m_funs) {
+        if (!ctx.is_bound(fun.getName()))
+            m_funs.insert(fun);
+    }
+    for (auto & ref : child.m_header_refs) {
+        if (!ctx.is_bound(ref.first))
+            m_header_refs.insert(ref);
+    }
+    m_includes.insert(child.m_includes.begin(), child.m_includes.end());
+    m_macros.insert(child.m_macros.begin(), child.m_macros.end());
+    m_addl_types.insert(m_addl_types.end(),
+                        child.m_addl_types.begin(),
+                        child.m_addl_types.end());
+    ctx.merge(child.ctx);
+    is_first = false;
+}
+
 ///////////////////////////////////////////////////////
 //
 //  Helpers
@@ -168,7 +194,12 @@ std::set<FunctionInfo> Requirements::functions() const
 { return m_funs; }
 
 std::set<std::string> Requirements::includes() const
-{ return m_includes; }
+{
+    std::set<std::string> ans = m_includes;
+    for (auto & ref : m_header_refs)
+        ans.insert(ref.second);
+    return ans;
+}
 
 std::set<Hash> Requirements::macros() const
 { return m_macros; }
@@ -216,9 +247,6 @@ clang::PresumedLoc Requirements::beginLoc() const
 clang::PresumedLoc Requirements::endLoc() const
 { return m_end_ploc; }
 
-Replacements Requirements::replacements() const
-{ return m_replacements; }
-
 TURef Requirements::tu() const
 { return m_tu; }
 
@@ -56,7 +56,6 @@ public:
     clang::SourceRange     normalizedSourceRange() const;
     clang::PresumedLoc     beginLoc()    const;
     clang::PresumedLoc     endLoc()      const;
-    Replacements           replacements() const;
     TURef                  tu()          const;
     SyntacticContext       syn_ctx()     const;
 
@@ -72,6 +71,12 @@ public:
     
     bool toplevel_is_macro() const { return toplev_is_macro; }
 
+    // Fold in the requirements gathered for a child subtree that
+    // follows everything already visited. References the child left
+    // free are dropped if this context binds them, so a parent can
+    // be summarized from its children without re-traversing them.
+    void merge(const Requirements & child);
+
     void setParent(AstRef p)
     { m_parent = p; }
 
@@ -89,9 +94,6 @@ public:
         m_normalized_source_range = nr;
     }
 
-    void setReplacements(const Replacements & r)
-    { m_replacements = r; }
-    
     clang::ASTContext * astContext()
     { return m_ast_context; }
 
@@ -110,6 +112,7 @@ private:
     std::set<BindingCtx::Binding> m_vars;
     std::set<FunctionInfo> m_funs;
     std::set<std::string> m_includes;
+    std::set<std::pair<std::string, std::string> > m_header_refs;
     std::set<Hash> m_macros;
     std::vector<Hash> m_addl_types;
     AstRef m_parent;
@@ -118,7 +121,6 @@ private:
     clang::PresumedLoc m_end_ploc;
     clang::SourceRange m_source_range;
     clang::SourceRange m_normalized_source_range;
-    Replacements m_replacements;
     bool toplev_is_macro, is_first;
     BindingCtx ctx;
 
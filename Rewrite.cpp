@@ -1,12 +1,92 @@
 #include "Ast.h"
 #include "Rewrite.h"
+#include "Batch.h"
+#include "Columns.h"
+#include "Diff.h"
+#include "Fingerprint.h"
+#include "Packed.h"
+#include "Reparse.h"
+#include "TypeDBEntry.h"
 #include "Utils.h"
 
+#include <algorithm>
+#include <condition_variable>
+#include <fstream>
+#include <mutex>
 #include <sstream>
+#include <thread>
 
 namespace clang_mutate {
 using namespace clang;
 
+unsigned serialize_threads = 1;
+
+void serializeRecords(
+    std::ostream & out,
+    size_t count,
+    const std::function<void(std::ostream &, size_t)> & serialize,
+    unsigned max_threads,
+    size_t chunk_size)
+{
+    size_t chunks = (count + chunk_size - 1) / chunk_size;
+    size_t threads = std::min<size_t>(max_threads, chunks);
+    if (threads <= 1) {
+        for (size_t i = 0; i < count; ++i)
+            serialize(out, i);
+        return;
+    }
+
+    // Workers claim chunks in order, but stay within a window of the
+    // chunks written out so far, so that the buffered output stays
+    // bounded however large the TU is.
+    const size_t window = 4 * threads;
+    std::vector<std::string> buffers(chunks);
+    std::vector<bool> done(chunks, false);
+    size_t next = 0;
+    size_t written = 0;
+    std::mutex mutex;
+    std::condition_variable ready;
+    std::condition_variable room;
+
+    auto worker = [&]() {
+        while (true) {
+            size_t chunk;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                room.wait(lock, [&]{ return next < written + window; });
+                if (next == chunks)
+                    return;
+                chunk = next++;
+            }
+            std::ostringstream oss;
+            size_t end = std::min(count, (chunk + 1) * chunk_size);
+            for (size_t i = chunk * chunk_size; i < end; ++i)
+                serialize(oss, i);
+            std::lock_guard<std::mutex> lock(mutex);
+            buffers[chunk] = oss.str();
+            done[chunk] = true;
+            ready.notify_all();
+        }
+    };
+
+    std::vector<std::thread> workers;
+    for (size_t i = 0; i < threads; ++i)
+        workers.push_back(std::thread(worker));
+    for (size_t chunk = 0; chunk < chunks; ++chunk) {
+        std::string text;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            ready.wait(lock, [&]{ return done[chunk]; });
+            text.swap(buffers[chunk]);
+            ++written;
+            room.notify_all();
+        }
+        out << text;
+    }
+    for (auto & t : workers)
+        t.join();
+}
+
 std::string getAstText(
     AstRef ast,
     bool normalized)
@@ -91,6 +171,44 @@ RewritingOpPtr printModified(TURef tu)
 RewritingOpPtr annotateWith(TURef tu, Annotator * annotator)
 { return new AnnotateOp(tu, annotator); }
 
+RewritingOpPtr printDiff(TURef tu)
+{ return new PrintDiffOp(tu); }
+
+RewritingOpPtr fingerprint(TURef tu)
+{ return new FingerprintOp(tu); }
+
+RewritingOpPtr reparse(TURef tu)
+{ return new ReparseOp(tu); }
+
+RewritingOpPtr applyDiff(TURef tu, const std::string & path)
+{ return new ReparseOp(tu, path); }
+
+RewritingOpPtr dumpTU(TURef tu,
+                      const std::set<std::string> & aux_keys,
+                      const std::set<std::string> & ast_keys,
+                      DumpFormat format)
+{ return new DumpOp(tu, aux_keys, ast_keys, format); }
+
+RewritingOpPtr jsonDelta(TURef tu, const std::set<std::string> & ast_keys)
+{ return new JsonDeltaOp(tu, ast_keys); }
+
+RewritingOpPtr batch(TURef tu, const std::string & path)
+{ return new BatchOp(tu, path); }
+
+RewritingOpPtr takeSnapshot(TURef tu, const std::string & name)
+{ return new SnapshotOp(SnapshotOp::Take, tu, name, ""); }
+
+RewritingOpPtr restoreSnapshot(const std::string & name)
+{ return new SnapshotOp(SnapshotOp::Restore, 0, name, ""); }
+
+RewritingOpPtr forkSnapshot(const std::string & name, const std::string & child)
+{ return new SnapshotOp(SnapshotOp::Fork, 0, name, child); }
+
+RewritingOpPtr writeColumns(TURef tu,
+                            const std::string & path,
+                            const std::vector<std::string> & fields)
+{ return new WriteColumnsOp(tu, path, fields); }
+
 RewritingOpPtr chain(const std::vector<RewritingOpPtr> & ops)
 { return new ChainedOp(ops); }
 
@@ -328,6 +446,367 @@ void PrintModifiedOp::print(std::ostream & o) const
 void PrintModifiedOp::execute(RewriterState & state) const
 { state.vars["$$"] = state.rewriter(m_tu).preview(TUs[m_tu]->source); }
 
+void PrintDiffOp::print(std::ostream & o) const
+{ o << "diff " << m_tu; }
+
+void PrintDiffOp::execute(RewriterState & state) const
+{
+    state.vars["$$"] = state.rewriter(m_tu).diff(TUs[m_tu]->source,
+                                                 TUs[m_tu]->filename.str());
+}
+
+void FingerprintOp::print(std::ostream & o) const
+{ o << "fingerprint " << m_tu; }
+
+void FingerprintOp::execute(RewriterState & state) const
+{
+    TU & tu = *TUs[m_tu];
+    state.vars["$$"] = state.rewriter(m_tu)
+        .fingerprint(tu.source, sourceHashes(tu)).str();
+}
+
+void ReparseOp::print(std::ostream & o) const
+{
+    if (m_diff.empty())
+        o << "reparse " << m_tu;
+    else
+        o << "apply-diff " << m_tu << " " << Utils::escape(m_diff);
+}
+
+void ReparseOp::execute(RewriterState & state) const
+{
+    std::string modified;
+    std::string error;
+    if (m_diff.empty()) {
+        modified = state.rewriter(m_tu).preview(TUs[m_tu]->source);
+    }
+    else {
+        std::ifstream in(m_diff);
+        if (!in) {
+            state.fail("could not read " + m_diff);
+            return;
+        }
+        std::ostringstream diff;
+        diff << in.rdbuf();
+        if (!applyUnifiedDiff(TUs[m_tu]->source, diff.str(),
+                              modified, error))
+        {
+            state.fail(m_diff + ": " + error);
+            return;
+        }
+    }
+    picojson::value summary;
+    if (!reparseTU(m_tu, modified, summary, error)) {
+        state.fail(error);
+        return;
+    }
+    state.rewriters.erase(m_tu);
+    // Saved buffers refer to the old ASTs.
+    for (auto it = state.snapshots.begin(); it != state.snapshots.end(); ) {
+        if (it->second.first == m_tu)
+            it = state.snapshots.erase(it);
+        else
+            ++it;
+    }
+    std::cout << summary.serialize();
+    state.vars["$$"] = "";
+}
+
+void DumpOp::print(std::ostream & o) const
+{
+    static const char * commands[] = { "json ", "jsonl ", "packed ", "sexp " };
+    o << commands[m_format] << m_tu;
+    std::string sep = " aux=";
+    for (auto & key : m_aux_keys) {
+        o << sep << key;
+        sep = ",";
+    }
+    sep = " fields=";
+    for (auto & key : m_ast_keys) {
+        o << sep << key;
+        sep = ",";
+    }
+}
+
+void DumpOp::execute(RewriterState & state) const
+{
+    TU & tu = *TUs[m_tu];
+    std::ostream & out = std::cout;
+    std::unique_ptr<PackedWriter> packed;
+    if (m_format == Dump_Packed)
+        packed.reset(new PackedWriter(out));
+
+    // Entries are separated by commas within a JSON array, or by
+    // newlines within a list of s-expressions; in JSON Lines, each is
+    // ended by a newline.
+    static const JsonSyntax json;
+    static const SexpSyntax sexp;
+    const RecordSyntax & syntax =
+        (m_format == Dump_Sexp) ? (const RecordSyntax &) sexp : json;
+    const char * open = "";
+    const char * next_sep = "";
+    const char * end = "";
+    const char * close = "";
+    switch (m_format) {
+    case Dump_Array:
+        open = "["; next_sep = ","; close = "]";
+        break;
+    case Dump_Lines:
+        end = "\n";
+        break;
+    case Dump_Sexp:
+        open = "("; next_sep = "\n"; close = ")";
+        break;
+    default:
+        break;
+    }
+
+    const char * sep = "";
+    auto write = [&](const picojson::value & entry)
+    {
+        if (packed) {
+            packed->write(entry);
+        }
+        else {
+            out << sep;
+            syntax.value(out, entry);
+            out << end;
+            sep = next_sep;
+        }
+    };
+
+    out << open;
+
+    FieldPlan plan(m_ast_keys);
+    bool include_aux = false;
+    bool string_table = false;
+    for (auto & aux_key : m_aux_keys) {
+        if (aux_key == "types") {
+            for (auto & entry : TypeDBEntry::databaseToJSON())
+                write(entry);
+        }
+        else if (aux_key == "macros") {
+            for (auto & entry : tu.macros->databaseToJSON())
+                write(entry);
+        }
+        else if (aux_key == "asts") {
+            include_aux = true;
+        }
+        else if (aux_key == "strings") {
+            string_table = true;
+        }
+        else {
+            for (auto & entry : tu.aux[aux_key])
+                write(entry);
+        }
+    }
+
+    if (packed) {
+        for (auto & ast : tu.asts)
+            packed->write(ast->toJSON(plan, include_aux));
+    }
+    else if (string_table) {
+        // Each string of the fields whose values repeat from one Ast
+        // to the next is written out once, as a {"str", "value"} entry
+        // just before the first Ast that uses it; the Asts refer to
+        // the entries as {"ref": N}. Entries are numbered in the order
+        // they appear, so the Asts are written serially. Text fields
+        // such as src_text are nearly always unique, and would only
+        // grow by going through the table.
+        StringTableSyntax strings(syntax,
+                                  { "class", "src_file_name",
+                                    "binary_file_path", "llvm_ir_file_path",
+                                    "includes" });
+        std::ostringstream record;
+        for (auto & ast : tu.asts) {
+            record.str("");
+            ast->writeRecord(record, strings, plan, include_aux);
+            for (auto & fresh : strings.take_fresh()) {
+                picojson::object entry;
+                entry["str"] = to_json(fresh.first);
+                entry["value"] = to_json(fresh.second);
+                write(picojson::value(entry));
+            }
+            out << sep << record.str() << end;
+            sep = next_sep;
+        }
+    }
+    else {
+        const char * first_sep = sep;
+        serializeRecords(
+            out, tu.asts.size(),
+            [&](std::ostream & o, size_t i) {
+                o << (i == 0 ? first_sep : next_sep);
+                tu.asts[i]->writeRecord(o, syntax, plan, include_aux);
+                o << end;
+            });
+    }
+    out << close;
+    state.vars["$$"] = "";
+}
+
+void JsonDeltaOp::print(std::ostream & o) const
+{
+    o << "json-delta " << m_tu;
+    std::string sep = " fields=";
+    for (auto & key : m_ast_keys) {
+        o << sep << key;
+        sep = ",";
+    }
+}
+
+void JsonDeltaOp::execute(RewriterState & state) const
+{
+    TU & tu = *TUs[m_tu];
+    EditBuffer & buffer = state.rewriter(m_tu);
+
+    // Sort out the Asts touched by the edits: an Ast in a replaced
+    // range is replaced if its parent is outside the range, and removed
+    // otherwise; the ancestors of each edited Ast enclose the edit.
+    std::set<AstCounter> replaced, removed, enclosing;
+    for (auto & target : buffer.targets()) {
+        if (target.replaces) {
+            AstCounter first = target.first.counter();
+            AstCounter last = target.last->exit_index();
+            for (AstCounter c = first; c <= last; ++c) {
+                AstCounter parent = tu.asts[c - 1]->parent().counter();
+                if (parent >= first && parent <= last)
+                    removed.insert(c);
+                else
+                    replaced.insert(c);
+            }
+        }
+        for (auto & ast : { target.first, target.last }) {
+            for (AstRef p = ast->parent(); p != NoAst; p = p->parent())
+                enclosing.insert(p.counter());
+        }
+    }
+    for (auto c : replaced)
+        enclosing.erase(c);
+    for (auto c : removed)
+        enclosing.erase(c);
+
+    picojson::array spans;
+    for (auto & span : buffer.spans()) {
+        picojson::object entry;
+        entry["begin_off"] = to_json(span.begin);
+        entry["end_off"] = to_json(span.end);
+        entry["new_begin_off"] = to_json(span.new_begin);
+        entry["new_end_off"] =
+            to_json(span.new_begin + SourceOffset(span.text.size()));
+        entry["text"] = to_json(span.text);
+        spans.push_back(picojson::value(entry));
+    }
+
+    std::ostream & out = std::cout;
+    JsonSyntax json;
+    json.begin_record(out);
+    json.field(out, true, "tu", to_json(m_tu));
+    json.field(out, false, "edits", picojson::value(spans));
+    json.field(out, false, "replaced", to_json(replaced));
+    json.field(out, false, "removed", to_json(removed));
+    json.field(out, false, "enclosing", to_json(enclosing));
+
+    std::set<AstCounter> changed(replaced);
+    changed.insert(enclosing.begin(), enclosing.end());
+    FieldPlan plan(m_ast_keys);
+    out << ",\"asts\":[";
+    const char * sep = "";
+    for (auto c : changed) {
+        out << sep;
+        tu.asts[c - 1]->writeRecord(out, json, plan, false);
+        sep = ",";
+    }
+    out << "]";
+    json.end_record(out);
+    state.vars["$$"] = "";
+}
+
+void BatchOp::print(std::ostream & o) const
+{ o << "batch " << m_tu << " " << Utils::escape(m_path); }
+
+void BatchOp::execute(RewriterState & state) const
+{
+    std::string error;
+    if (!runBatch(m_tu, m_path, std::cout, error)) {
+        state.fail(error);
+        return;
+    }
+    state.vars["$$"] = "";
+}
+
+void SnapshotOp::print(std::ostream & o) const
+{
+    switch (m_mode) {
+    case Take:
+        o << "snapshot " << m_tu << " as " << m_name;
+        break;
+    case Restore:
+        o << "restore " << m_name;
+        break;
+    case Fork:
+        o << "fork " << m_name << " as " << m_child;
+        break;
+    }
+}
+
+void SnapshotOp::execute(RewriterState & state) const
+{
+    if (m_mode == Take) {
+        EditBuffer & buffer = state.rewriter(m_tu);
+        buffer.freeze();
+        state.snapshots[m_name] = std::make_pair(m_tu, buffer);
+        state.vars["$$"] = "";
+        return;
+    }
+
+    auto search = state.snapshots.find(m_name);
+    if (search == state.snapshots.end()) {
+        state.fail("no snapshot named " + m_name);
+        return;
+    }
+    if (m_mode == Fork) {
+        state.snapshots[m_child] = search->second;
+    }
+    else {
+        TURef tu = search->second.first;
+        if (!TUs.contains(tu)) {
+            std::ostringstream oss;
+            oss << "translation unit " << tu << " is no longer loaded";
+            state.fail(oss.str());
+            return;
+        }
+        state.rewriters[tu] = search->second.second;
+    }
+    state.vars["$$"] = "";
+}
+
+void WriteColumnsOp::print(std::ostream & o) const
+{
+    o << "columns " << m_tu << " " << Utils::escape(m_path);
+    std::string sep = " fields=";
+    for (auto & key : m_fields) {
+        o << sep << key;
+        sep = ",";
+    }
+}
+
+void WriteColumnsOp::execute(RewriterState & state) const
+{
+    size_t bytes;
+    std::string error;
+    TU & tu = *TUs[m_tu];
+    if (!clang_mutate::writeColumns(tu, m_fields, m_path, bytes, error)) {
+        state.fail(error);
+        return;
+    }
+    std::map<std::string, picojson::value> ans;
+    ans["rows"] = to_json(tu.asts.size());
+    ans["bytes"] = to_json(bytes);
+    std::cout << to_json(ans).serialize();
+    state.vars["$$"] = "";
+}
+
 void AnnotateOp::print(std::ostream & o) const
 { o << "annotate(" << m_annotate->describe() << ")"; }
 
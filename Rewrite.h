@@ -12,6 +12,7 @@
 #include "clang/AST/AST.h"
 #include "clang/Rewrite/Core/Rewriter.h"
 
+#include <functional>
 #include <string>
 #include <set>
 #include <map>
@@ -26,6 +27,11 @@ namespace clang_mutate
 class RewritingOp;
 typedef ref_ptr<RewritingOp> RewritingOpPtr;
 class Annotator;
+
+// How DumpOp writes its entries: as a JSON array, as JSON Lines, as a
+// packed binary stream (see Packed.h), or as a list of s-expressions.
+enum DumpFormat { Dump_Array, Dump_Lines, Dump_Packed, Dump_Sexp };
+
 RewritingOpPtr setText      (AstRef ast,
                              const std::string & text,
                              bool allow_renormalization = true);
@@ -46,6 +52,24 @@ RewritingOpPtr echoTo        (const std::string & text, const std::string & var)
 RewritingOpPtr printModified (TURef tu);
 RewritingOpPtr printOriginal (TURef tu);
 RewritingOpPtr annotateWith  (TURef tu, Annotator * ann);
+RewritingOpPtr printDiff     (TURef tu);
+RewritingOpPtr fingerprint   (TURef tu);
+RewritingOpPtr reparse       (TURef tu);
+RewritingOpPtr applyDiff     (TURef tu, const std::string & path);
+RewritingOpPtr dumpTU        (TURef tu,
+                              const std::set<std::string> & aux_keys,
+                              const std::set<std::string> & ast_keys,
+                              DumpFormat format = Dump_Array);
+RewritingOpPtr jsonDelta     (TURef tu,
+                              const std::set<std::string> & ast_keys);
+RewritingOpPtr batch         (TURef tu, const std::string & path);
+RewritingOpPtr takeSnapshot  (TURef tu, const std::string & name);
+RewritingOpPtr restoreSnapshot(const std::string & name);
+RewritingOpPtr forkSnapshot  (const std::string & name,
+                              const std::string & child);
+RewritingOpPtr writeColumns  (TURef tu,
+                              const std::string & path,
+                              const std::vector<std::string> & fields);
 RewritingOpPtr chain (const std::vector<RewritingOpPtr> & ops);
 RewritingOpPtr note  (const std::string & text);
 
@@ -56,6 +80,22 @@ RewritingOpPtr clear_vars();
 
 typedef std::map<std::string, std::string> NamedText;
 
+// The number of threads with which to serialize ASTs.
+extern unsigned serialize_threads;
+
+// Call `serialize(o, i)` for each i in [0, count), where it should
+// write the i'th record to `o`, and write the records to `out` in
+// order. With more than one thread, chunks of `chunk_size`
+// consecutive records are serialized concurrently into separate
+// buffers, so `serialize` must only read state which nothing else is
+// changing.
+void serializeRecords(
+    std::ostream & out,
+    size_t count,
+    const std::function<void(std::ostream &, size_t)> & serialize,
+    unsigned threads = serialize_threads,
+    size_t chunk_size = 256);
+
 struct RewriterState
 {
     RewriterState()
@@ -69,6 +109,8 @@ struct RewriterState
     EditBuffer & rewriter(TURef tu);
 
     std::map<TURef, EditBuffer> rewriters;
+    // Named copies of rewrite buffers, and the TUs they belong to.
+    std::map<std::string, std::pair<TURef, EditBuffer> > snapshots;
     NamedText   vars;
     bool        failed;
     std::string message;
@@ -83,10 +125,18 @@ public:
                 , Op_Get
                 , Op_Echo
                 , Op_PrintModified
+                , Op_PrintDiff
+                , Op_Fingerprint
                 , Op_PrintOriginal
                 , Op_SetRange
                 , Op_Annotate
                 , Op_StateManip
+                , Op_Reparse
+                , Op_Dump
+                , Op_JsonDelta
+                , Op_Batch
+                , Op_Snapshot
+                , Op_WriteColumns
     };
 
     RewritingOp() : count(0) {}
@@ -163,6 +213,176 @@ private:
     TURef m_tu;
 };
 
+class PrintDiffOp : public RewritingOp
+{
+public:
+    PrintDiffOp(TURef tu) : RewritingOp(), m_tu(tu) {}
+    OpKind kind() const { return Op_PrintDiff; }
+    AstRef target() const { return NoAst; }
+    void print(std::ostream & o) const;
+    void execute(RewriterState & state) const;
+private:
+    TURef m_tu;
+};
+
+// Set $$ to the fingerprint of a TU's modified source (see
+// Fingerprint.h).
+class FingerprintOp : public RewritingOp
+{
+public:
+    FingerprintOp(TURef tu) : RewritingOp(), m_tu(tu) {}
+    OpKind kind() const { return Op_Fingerprint; }
+    AstRef target() const { return NoAst; }
+    void print(std::ostream & o) const;
+    void execute(RewriterState & state) const;
+private:
+    TURef m_tu;
+};
+
+// Rebuild a TU from its modified source (see Reparse.h), and reset
+// its rewrite buffer. Given a diff, rebuild it instead from its
+// original source with the diff applied.
+class ReparseOp : public RewritingOp
+{
+public:
+    ReparseOp(TURef tu, const std::string & diff = "")
+        : RewritingOp(), m_tu(tu), m_diff(diff)
+    {}
+    OpKind kind() const { return Op_Reparse; }
+    AstRef target() const { return NoAst; }
+    void print(std::ostream & o) const;
+    void execute(RewriterState & state) const;
+private:
+    TURef m_tu;
+    std::string m_diff;
+};
+
+// Write a TU's aux entries and Asts to std::cout as a JSON array,
+// streaming each one out as it is serialized rather than building the
+// whole document first. As JSON Lines, each entry is instead written
+// as a JSON object on a line of its own; packed, each is a record of
+// a binary stream; as s-expressions, each is an alist on a line of its
+// own, within one enclosing list. The aux key "strings" writes the
+// Asts' class names, file names and includes through a table (see
+// StringTableSyntax in Json.h).
+class DumpOp : public RewritingOp
+{
+public:
+    DumpOp(TURef tu,
+           const std::set<std::string> & aux_keys,
+           const std::set<std::string> & ast_keys,
+           DumpFormat format)
+        : RewritingOp()
+        , m_tu(tu)
+        , m_aux_keys(aux_keys)
+        , m_ast_keys(ast_keys)
+        , m_format(format)
+    {}
+    OpKind kind() const { return Op_Dump; }
+    AstRef target() const { return NoAst; }
+    void print(std::ostream & o) const;
+    void execute(RewriterState & state) const;
+private:
+    TURef m_tu;
+    std::set<std::string> m_aux_keys;
+    std::set<std::string> m_ast_keys;
+    DumpFormat m_format;
+};
+
+// Report what a TU's pending edits will change, as a JSON object: the
+// text spans which change (with their offsets before and after the
+// edits), the counters of the Asts which are replaced, removed within
+// a replaced range, or enclose an edit, and the JSON of the replaced
+// and enclosing Asts. Unchanged Asts are not serialized at all.
+class JsonDeltaOp : public RewritingOp
+{
+public:
+    JsonDeltaOp(TURef tu, const std::set<std::string> & ast_keys)
+        : RewritingOp()
+        , m_tu(tu)
+        , m_ast_keys(ast_keys)
+    {}
+    OpKind kind() const { return Op_JsonDelta; }
+    AstRef target() const { return NoAst; }
+    void print(std::ostream & o) const;
+    void execute(RewriterState & state) const;
+private:
+    TURef m_tu;
+    std::set<std::string> m_ast_keys;
+};
+
+// Apply each variant in a manifest to a TU, writing the results to
+// std::cout (see Batch.h). The TU's own rewrite buffer is untouched.
+class BatchOp : public RewritingOp
+{
+public:
+    BatchOp(TURef tu, const std::string & path)
+        : RewritingOp()
+        , m_tu(tu)
+        , m_path(path)
+    {}
+    OpKind kind() const { return Op_Batch; }
+    AstRef target() const { return NoAst; }
+    void print(std::ostream & o) const;
+    void execute(RewriterState & state) const;
+private:
+    TURef m_tu;
+    std::string m_path;
+};
+
+// Save a TU's rewrite buffer under a name, bring a saved buffer back
+// as its TU's rewrite buffer, or save a copy of a saved buffer under
+// another name. A saved buffer is frozen (see EditBuffer::freeze), so
+// each of these copies only a pointer to the edits, and buffers
+// derived from it share its edits rather than replaying them.
+class SnapshotOp : public RewritingOp
+{
+public:
+    enum Mode { Take, Restore, Fork };
+
+    SnapshotOp(Mode mode,
+               TURef tu,
+               const std::string & name,
+               const std::string & child)
+        : RewritingOp()
+        , m_mode(mode)
+        , m_tu(tu)
+        , m_name(name)
+        , m_child(child)
+    {}
+    OpKind kind() const { return Op_Snapshot; }
+    AstRef target() const { return NoAst; }
+    void print(std::ostream & o) const;
+    void execute(RewriterState & state) const;
+private:
+    Mode m_mode;
+    TURef m_tu;
+    std::string m_name;
+    std::string m_child;
+};
+
+// Write the columnar export of a TU's Asts (see Columns.h) to a file.
+class WriteColumnsOp : public RewritingOp
+{
+public:
+    WriteColumnsOp(TURef tu,
+                   const std::string & path,
+                   const std::vector<std::string> & fields)
+        : RewritingOp()
+        , m_tu(tu)
+        , m_path(path)
+        , m_fields(fields)
+    {}
+    OpKind kind() const { return Op_WriteColumns; }
+    AstRef target() const { return NoAst; }
+    void print(std::ostream & o) const;
+    void execute(RewriterState & state) const;
+private:
+    TURef m_tu;
+    std::string m_path;
+    std::vector<std::string> m_fields;
+};
+
 class Annotator {
 public:
     virtual ~Annotator() {}
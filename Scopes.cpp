@@ -28,6 +28,40 @@ void Scope::declare(const IdentifierInfo * id)
         scopes.push(ScopeInfo(id));
 }
 
+PTNode Scope::import(const Scope & other,
+                     PTNode pos,
+                     std::map<PTNode, PTNode> & imported,
+                     long counters)
+{
+    if (pos == NoNode)
+        return NoNode;
+    auto search = imported.find(pos);
+    if (search != imported.end())
+        return search->second;
+
+    PTNode parent = import(other, other.scopes.parentOf(pos),
+                           imported, counters);
+    ScopeInfo info = other.scopes.at(pos);
+    AstRef scope;
+    if (info.getScope(scope) && scope != NoAst)
+        info = ScopeInfo(AstRef(scope.tuid(), scope.counter() + counters));
+    PTNode copy = scopes.add(info, parent);
+    imported[pos] = copy;
+    return copy;
+}
+
+void Scope::write(BinaryWriter & out) const
+{
+    scopes.write(out, [](BinaryWriter & w, const ScopeInfo & info)
+                      { info.write(w); });
+}
+
+void Scope::read(BinaryReader & in)
+{
+    scopes.read(in, [](BinaryReader & r)
+                    { return ScopeInfo::read(r); });
+}
+
 PTNode Scope::current_scope_position() const
 { return scopes.position(); }
 
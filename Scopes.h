@@ -3,10 +3,12 @@
 
 #include "AstRef.h"
 #include "PointedTree.h"
+#include "Serialization.h"
 
 #include "clang/Basic/LLVM.h"
 #include "clang/AST/AST.h"
 
+#include <map>
 #include <vector>
 #include <string>
 
@@ -32,6 +34,19 @@ namespace clang_mutate {
 
       std::vector<std::vector<std::string> >
           get_names_in_scope() const;
+
+      // Copy the node at `pos` in `other`, and its ancestors, into
+      // this tree, returning the copy's position. `imported` maps the
+      // positions in `other` already copied (or known to be the same
+      // as a position in this tree) to their positions here, and
+      // AstRefs in the copies are moved by `counters`.
+      PTNode import(const Scope & other,
+                    PTNode pos,
+                    std::map<PTNode, PTNode> & imported,
+                    long counters);
+
+      void write(BinaryWriter & out) const;
+      void read(BinaryReader & in);
   private:
       struct ScopeInfo
       {
@@ -39,6 +54,8 @@ namespace clang_mutate {
           ScopeInfo(AstRef _scope) : id(""), scope(_scope) {}
           ScopeInfo(const clang::IdentifierInfo* ident)
           : id(ident->getName().str()), scope(NoAst) {}
+          ScopeInfo(const std::string & _id, AstRef _scope)
+          : id(_id), scope(_scope) {}
           
           bool getDeclaration(std::string & result) const
           {
@@ -52,6 +69,18 @@ namespace clang_mutate {
               return id == "";
           }
 
+          void write(BinaryWriter & out) const
+          {
+              out.put(id);
+              out.put(scope);
+          }
+
+          static ScopeInfo read(BinaryReader & in)
+          {
+              std::string id = in.get_string();
+              return ScopeInfo(id, in.get_astref());
+          }
+
       private:
           std::string id;
           AstRef scope;
@@ -0,0 +1,188 @@
+#ifndef CLANG_MUTATE_SERIALIZATION_H
+#define CLANG_MUTATE_SERIALIZATION_H
+
+#include "AstRef.h"
+#include "Hash.h"
+
+#include <stdint.h>
+
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+namespace clang {
+class IdentifierInfo;
+}
+
+namespace clang_mutate {
+
+// A compact binary encoding of clang-mutate's data structures.
+// Integers are written as LEB128 varints and strings are length
+// prefixed. Identifiers are written as indices into a table of
+// identifiers which the writer is given up front; readers map those
+// indices back to identifier handles whose relative order matches the
+// original pointers, so that sets keyed on identifiers iterate in the
+// same order once reloaded. AstRefs are written as bare counters and
+// read back into the TU given to the reader.
+class BinaryWriter
+{
+public:
+    BinaryWriter(std::string & _out) : out(_out) {}
+
+    void put(uint64_t n)
+    {
+        do {
+            unsigned char byte = n & 0x7f;
+            n >>= 7;
+            if (n != 0)
+                byte |= 0x80;
+            out.push_back(byte);
+        } while (n != 0);
+    }
+
+    void put(bool b) { put(uint64_t(b ? 1 : 0)); }
+    void put(const char * s) = delete;
+    void put(const Hash & h) { put(uint64_t(h.hash())); }
+    void put(const AstRef & ast) { put(uint64_t(ast.counter())); }
+
+    void put(const std::string & s)
+    {
+        put(uint64_t(s.size()));
+        out.append(s);
+    }
+
+    // Signed values (such as offsets which may be negative) are
+    // zig-zag encoded, so that small magnitudes stay small.
+    void put_signed(int64_t n)
+    { put(uint64_t((n << 1) ^ (n >> 63))); }
+
+    void setIdentifiers(const std::vector<const clang::IdentifierInfo*> & ids)
+    {
+        identifiers.clear();
+        for (size_t i = 0; i < ids.size(); ++i)
+            identifiers[ids[i]] = i;
+    }
+
+    // Null identifiers are written as 0, others as their index + 1.
+    void put(const clang::IdentifierInfo * id)
+    { put(uint64_t(id == NULL ? 0 : identifiers.at(id) + 1)); }
+
+    template <typename T>
+    void put(const std::vector<T> & xs)
+    {
+        put(uint64_t(xs.size()));
+        for (auto & x : xs)
+            put(x);
+    }
+
+    template <typename T>
+    void put(const std::set<T> & xs)
+    {
+        put(uint64_t(xs.size()));
+        for (auto & x : xs)
+            put(x);
+    }
+
+private:
+    std::string & out;
+    std::map<const clang::IdentifierInfo*, size_t> identifiers;
+};
+
+class BinaryReader
+{
+public:
+    BinaryReader(const std::string & _in, TURef _tu = 0)
+        : in(_in), pos(0), failed(false), tu(_tu) {}
+
+    // True if the input ran out before a read completed. Reads past
+    // the end return zeroes and empty strings.
+    bool fail() const { return failed; }
+    bool done() const { return pos >= in.size(); }
+
+    uint64_t get_uint()
+    {
+        uint64_t n = 0;
+        for (unsigned shift = 0; shift < 64; shift += 7) {
+            if (pos >= in.size()) {
+                failed = true;
+                return 0;
+            }
+            unsigned char byte = in[pos++];
+            n |= uint64_t(byte & 0x7f) << shift;
+            if ((byte & 0x80) == 0)
+                break;
+        }
+        return n;
+    }
+
+    int64_t get_signed()
+    {
+        uint64_t n = get_uint();
+        return int64_t(n >> 1) ^ -int64_t(n & 1);
+    }
+
+    bool get_bool() { return get_uint() != 0; }
+    Hash get_hash() { return Hash(size_t(get_uint())); }
+
+    AstRef get_astref()
+    {
+        AstCounter counter = get_uint();
+        return counter == 0 ? NoAst : AstRef(tu, counter);
+    }
+
+    std::vector<AstRef> get_astrefs()
+    {
+        std::vector<AstRef> ans(get_uint());
+        for (auto & ast : ans)
+            ast = get_astref();
+        return ans;
+    }
+
+    std::vector<std::string> get_strings()
+    {
+        std::vector<std::string> ans(get_uint());
+        for (auto & s : ans)
+            s = get_string();
+        return ans;
+    }
+
+    std::string get_string()
+    {
+        uint64_t size = get_uint();
+        if (size > in.size() - pos) {
+            failed = true;
+            pos = in.size();
+            return "";
+        }
+        std::string s = in.substr(pos, size);
+        pos += size;
+        return s;
+    }
+
+    void setIdentifiers(const std::vector<const clang::IdentifierInfo*> & ids)
+    { identifiers = ids; }
+
+    const clang::IdentifierInfo * get_identifier()
+    {
+        uint64_t i = get_uint();
+        if (i == 0)
+            return NULL;
+        if (i > identifiers.size()) {
+            failed = true;
+            return NULL;
+        }
+        return identifiers[i - 1];
+    }
+
+private:
+    const std::string & in;
+    size_t pos;
+    bool failed;
+    TURef tu;
+    std::vector<const clang::IdentifierInfo*> identifiers;
+};
+
+} // end namespace clang_mutate
+
+#endif
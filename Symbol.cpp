@@ -0,0 +1,91 @@
+#include "Symbol.h"
+
+#include <atomic>
+#include <cassert>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+
+namespace clang_mutate {
+
+namespace {
+// The interned strings. TUs may be built concurrently, so interning is
+// guarded by a mutex. Looking a string up is not: the strings never
+// move once interned, and are found through fixed-size chunks of
+// pointers to them, which never move either (unlike the blocks of a
+// std::deque, whose index is reallocated as it grows). Each new string
+// is published by the release store to `size`, which str() loads with
+// acquire before reading it, so whichever thread an id came from, the
+// chunk and string it names are visible.
+struct SymbolTable
+{
+    static const uint32_t ChunkBits = 12;
+    static const uint32_t ChunkSize = 1u << ChunkBits;
+    static const uint32_t MaxChunks = 1u << 16;
+
+    SymbolTable() : size(0) { intern(""); }
+
+    uint32_t intern(const std::string & s)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = ids.find(s);
+        if (it != ids.end())
+            return it->second;
+        uint32_t id = size.load(std::memory_order_relaxed);
+        uint32_t chunk = id >> ChunkBits;
+        assert(chunk < MaxChunks);
+        if (!chunks[chunk])
+            chunks[chunk].reset(new const std::string*[ChunkSize]);
+        it = ids.insert(std::make_pair(s, id)).first;
+        chunks[chunk][id & (ChunkSize - 1)] = &it->first;
+        size.store(id + 1, std::memory_order_release);
+        return id;
+    }
+
+    const std::string & str(uint32_t id) const
+    {
+        uint32_t published = size.load(std::memory_order_acquire);
+        assert(id < published);
+        (void) published;
+        return *chunks[id >> ChunkBits][id & (ChunkSize - 1)];
+    }
+
+    std::mutex mutex;
+    std::unordered_map<std::string, uint32_t> ids;
+    std::unique_ptr<const std::string*[]> chunks[MaxChunks];
+    std::atomic<uint32_t> size;
+};
+
+SymbolTable & symbols()
+{
+    static SymbolTable table;
+    return table;
+}
+}
+
+uint32_t Symbol::intern(const std::string & s)
+{ return symbols().intern(s); }
+
+const std::string & Symbol::str() const
+{ return symbols().str(m_id); }
+
+namespace AstClass {
+const Symbol CaseStmt("CaseStmt");
+const Symbol CompoundStmt("CompoundStmt");
+const Symbol CXXConstructor("CXXConstructor");
+const Symbol CXXConversionDecl("CXXConversionDecl");
+const Symbol CXXDestructor("CXXDestructor");
+const Symbol CXXForRangeStmt("CXXForRangeStmt");
+const Symbol CXXMethod("CXXMethod");
+const Symbol DeclStmt("DeclStmt");
+const Symbol DoStmt("DoStmt");
+const Symbol ForStmt("ForStmt");
+const Symbol Function("Function");
+const Symbol IfStmt("IfStmt");
+const Symbol LabelStmt("LabelStmt");
+const Symbol ParmVar("ParmVar");
+const Symbol Var("Var");
+const Symbol WhileStmt("WhileStmt");
+} // end namespace AstClass
+
+} // end namespace clang_mutate
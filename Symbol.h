@@ -0,0 +1,76 @@
+#ifndef CLANG_MUTATE_SYMBOL_H
+#define CLANG_MUTATE_SYMBOL_H
+
+#include "Json.h"
+
+#include <stdint.h>
+
+#include <iostream>
+#include <string>
+
+namespace clang_mutate {
+
+// An interned string. Each distinct string is stored once, in a table
+// shared by every TU, and a Symbol is just its index in that table, so
+// copying and comparing Symbols are integer operations.
+class Symbol
+{
+public:
+    // The empty string.
+    Symbol() : m_id(0) {}
+
+    explicit Symbol(const std::string & s) : m_id(intern(s)) {}
+    explicit Symbol(const char * s) : m_id(intern(s)) {}
+
+    const std::string & str() const;
+
+    bool empty() const { return m_id == 0; }
+
+    bool operator==(const Symbol & that) const
+    { return m_id == that.m_id; }
+
+    bool operator!=(const Symbol & that) const
+    { return m_id != that.m_id; }
+
+    // Orders Symbols by when they were first interned, not by their
+    // text; only meant for use as a key in ordered containers.
+    bool operator<(const Symbol & that) const
+    { return m_id < that.m_id; }
+
+private:
+    static uint32_t intern(const std::string & s);
+
+    uint32_t m_id;
+};
+
+// The Ast class names which clang-mutate looks for.
+namespace AstClass {
+extern const Symbol CaseStmt;
+extern const Symbol CompoundStmt;
+extern const Symbol CXXConstructor;
+extern const Symbol CXXConversionDecl;
+extern const Symbol CXXDestructor;
+extern const Symbol CXXForRangeStmt;
+extern const Symbol CXXMethod;
+extern const Symbol DeclStmt;
+extern const Symbol DoStmt;
+extern const Symbol ForStmt;
+extern const Symbol Function;
+extern const Symbol IfStmt;
+extern const Symbol LabelStmt;
+extern const Symbol ParmVar;
+extern const Symbol Var;
+extern const Symbol WhileStmt;
+} // end namespace AstClass
+
+} // end namespace clang_mutate
+
+inline std::ostream & operator<<(std::ostream & o,
+                                 const clang_mutate::Symbol & sym)
+{ o << sym.str(); return o; }
+
+template <> inline
+picojson::value to_json(const clang_mutate::Symbol & sym)
+{ return to_json(sym.str()); }
+
+#endif
@@ -2,6 +2,7 @@
 #define CLANG_MUTATE_SYNTACTIC_CONTEXT_H
 
 #include "Json.h"
+#include "Serialization.h"
 
 namespace clang_mutate {
 
@@ -36,6 +37,12 @@ struct SyntacticContext
     { return this->m_kind < that.m_kind; }
 
     picojson::value toJSON() const;
+
+    void write(BinaryWriter & out) const
+    { out.put(uint64_t(m_kind)); }
+
+    static SyntacticContext read(BinaryReader & in)
+    { return SyntacticContext(Kind(in.get_uint())); }
 private:
     SyntacticContext(Kind k) : m_kind(k) {}
     Kind m_kind;
@@ -15,19 +15,66 @@
 #include "clang/AST/ASTContext.h"
 #include "clang/AST/RecursiveASTVisitor.h"
 #include "clang/Rewrite/Core/Rewriter.h"
+#include "llvm/Support/FileSystem.h"
 #include "llvm/Support/SaveAndRestore.h"
 
+#include <mutex>
+
 namespace clang_mutate {
 using namespace clang;
 
-std::map<TURef, TU*> TUs;
+TUTable TUs;
+
+TURef TUTable::reserve(size_t count)
+{
+    TURef first = m_slots.size();
+    m_slots.resize(first + count, NULL);
+    return first;
+}
+
+static std::mutex tu_registry_mutex;
 
-TU * tu_in_progress = NULL;
+TURef reserveTURefs(size_t count)
+{
+    std::lock_guard<std::mutex> lock(tu_registry_mutex);
+    return TUs.reserve(count);
+}
+
+void registerTU(TU * tu)
+{
+    std::lock_guard<std::mutex> lock(tu_registry_mutex);
+    TUs.set(tu->tuid, tu);
+}
+
+thread_local TU * tu_in_progress = NULL;
+
+bool single_pass_requirements = false;
 
 TU::~TU()
+{}
+
+void TU::detach()
 {
-    for (auto & ast : asts)
-        delete ast;
+    if (ci == NULL)
+        return;
+
+    if (ci->hasSourceManager()) {
+        SourceManager & sm = ci->getSourceManager();
+        source = sm.getBufferData(sm.getMainFileID()).str();
+        dependencies.clear();
+        for (auto it = sm.fileinfo_begin(); it != sm.fileinfo_end(); ++it) {
+            llvm::SmallString<256> path(it->first->getName());
+            llvm::sys::fs::make_absolute(path);
+            dependencies.push_back(path.str());
+        }
+    }
+    macros = MacroDB::getShared(ci);
+
+    // The MacroDB is keyed on the CompilerInstance, whose address may
+    // be reused by the next one.
+    MacroDB::release(ci);
+    delete ci;
+    ci = NULL;
 }
 
 AstRef TU::nextAstRef() const
@@ -52,7 +99,8 @@ class BuildTU
     typedef std::set<clang::IdentifierInfo*> VarScope;
     
   public:
-    BuildTU(TU & _tu, CompilerInstance * _ci, bool _with_cfg)
+    BuildTU(TU & _tu, CompilerInstance * _ci, bool _with_cfg,
+            SourceOffset _keep_body)
         : ci(_ci)
         , tu(_tu)
         , sm(_ci->getSourceManager())
@@ -60,19 +108,35 @@ class BuildTU
         , decls(_tu.aux["decls"])
         , function_starts(_tu.function_starts)
         , with_cfg(_with_cfg)
-    {}
+        , single_pass(single_pass_requirements)
+        , keep_body(_keep_body)
+    {
+        tu.with_cfg = with_cfg;
+    }
 
     ~BuildTU() {}
 
+    // Only consulted when function bodies are being skipped.
+    virtual bool shouldSkipFunctionBody(Decl * D)
+    {
+        SourceLocation begin = D->getSourceRange().getBegin();
+        return SourceOffset(sm.getDecomposedLoc(begin).second) != keep_body;
+    }
+
     virtual void HandleTranslationUnit(ASTContext &Context)
     {
         SourceManager & sm = ci->getSourceManager();
-        tu.filename = Utils::safe_realpath(
-            sm.getFileEntryForID(sm.getMainFileID())->getName());
+        tu.filename = Symbol(Utils::safe_realpath(
+            sm.getFileEntryForID(sm.getMainFileID())->getName()));
 
         this->Context = &Context;
+        clear_type_cache();
+        TypeDBEntry::setRecorder(&tu.type_hashes);
         spine.clear();
         spine.push_back(NoAst);
+        pending.clear();
+        pending.push_back(Requirements(tu.tuid, &Context,
+                                       SyntacticContext::TopLevel(), ci));
 
         // Add an empty top-level variable scope
         var_scopes.clear();
@@ -86,8 +150,12 @@ class BuildTU
         for (auto & decl : functions)
             processFunctionDecl(decl.first, decl.second);
 
+        setReplacements();
+
         if (with_cfg)
             GenerateCFG(tu, *ci, Context);
+
+        TypeDBEntry::setRecorder(NULL);
     }
 
     void processFunctionDecl(AstRef decl_ast, AstRef body_ast)
@@ -133,18 +201,111 @@ class BuildTU
         ast->setInMacroExpansion(clang_obj->getLocStart().isMacroID() &&
                                  clang_obj->getLocEnd().isMacroID());
 
-        Renames renames(required.variables(),
-                        required.functions());
-        RenameFreeVar renamer(clang_obj, sm, ci->getLangOpts(),
-                              ast->sourceRange().getBegin(),
-                              ast->sourceRange().getEnd(),
-                              renames);
-        ast->setReplacements(renamer.getReplacements());
+        // In single-pass mode the requirements are not known until
+        // the subtree has been visited; see popSpine().
+        if (single_pass)
+            pending.push_back(required);
 
         spine.push_back(ast);
         return ast;
     }
 
+    // Give each AST the slice of the TU's rename table which lies
+    // within its text.
+    void setReplacements()
+    {
+        tu.renames.finalize();
+        for (auto & ast : tu.asts) {
+            std::pair<FileID, unsigned> decomp =
+                sm.getDecomposedExpansionLoc(ast->sourceRange().getBegin());
+            if (decomp.first != sm.getMainFileID() ||
+                ast->initial_offset() == BadOffset ||
+                ast->final_offset() == BadOffset)
+            {
+                continue;
+            }
+            ast->setReplacements(
+                tu.renames.slice(decomp.second,
+                                 ast->initial_offset(),
+                                 ast->final_offset()));
+        }
+    }
+
+    // Remove the innermost AST from the spine once its traversal is
+    // complete, recording its exit index: every AST created since it
+    // was pushed is one of its descendants. In single-pass mode, this
+    // is also where the AST's requirements are finalized and merged
+    // into its parent's.
+    void popSpine()
+    {
+        AstRef ast = spine.back();
+        ast->setExitIndex(tu.asts.size());
+        ast->expand_to_child_ranges();
+        spine.pop_back();
+
+        if (!single_pass)
+            return;
+
+        Requirements & reqs = pending.back();
+        ast->setIncludes(reqs.includes());
+        ast->setMacros(reqs.macros());
+        ast->setTypes(reqs.types());
+        ast->setFreeVariables(reqs.variables());
+        ast->setFreeFunctions(reqs.functions());
+
+        Requirements child = reqs;
+        pending.pop_back();
+        if (spine.back() != NoAst)
+            pending.back().merge(child);
+    }
+
+    // Single-pass requirements: forward the nodes seen by this
+    // traversal to the requirements of the innermost enclosing AST.
+    // Nodes outside of any AST are ignored, as they would be by a
+    // per-AST Requirements traversal.
+    Requirements * enclosingRequirements()
+    {
+        if (!single_pass || spine.back() == NoAst)
+            return NULL;
+        return &pending.back();
+    }
+
+    bool VisitVarDecl(VarDecl * d)
+    {
+        if (Requirements * reqs = enclosingRequirements())
+            reqs->VisitVarDecl(d);
+        return true;
+    }
+
+    bool VisitTypedefDecl(TypedefDecl * d)
+    {
+        if (Requirements * reqs = enclosingRequirements())
+            reqs->VisitTypedefDecl(d);
+        return true;
+    }
+
+    bool VisitDeclRefExpr(DeclRefExpr * e)
+    {
+        tu.renames.add(e, sm, ci->getLangOpts());
+        if (Requirements * reqs = enclosingRequirements())
+            reqs->VisitDeclRefExpr(e);
+        return true;
+    }
+
+    bool VisitExplicitCastExpr(ExplicitCastExpr * e)
+    {
+        if (Requirements * reqs = enclosingRequirements())
+            reqs->VisitExplicitCastExpr(e);
+        return true;
+    }
+
+    bool VisitUnaryExprOrTypeTraitExpr(UnaryExprOrTypeTraitExpr * e)
+    {
+        if (Requirements * reqs = enclosingRequirements())
+            reqs->VisitUnaryExprOrTypeTraitExpr(e);
+        return true;
+    }
+
     bool VisitStmt(Stmt * s)
     {
         AstRef parent = spine.back();
@@ -168,7 +329,8 @@ class BuildTU
                               Context,
                               syn_ctx,
                               ci);
-            reqs.TraverseStmt(s);
+            if (!single_pass)
+                reqs.TraverseStmt(s);
 
             AstRef ast = makeAst(s, reqs);
             if (parent != NoAst) {
@@ -176,13 +338,15 @@ class BuildTU
                     ast->setIsGuard(
                         Utils::IsGuardStmt(s, parent_stmt));
                 }
-                if (ast->className() == "CompoundStmt" &&
+                if (ast->className() == AstClass::CompoundStmt &&
                     Utils::is_function_decl(parent, *ci))
                 {
                     functions.push_back(std::make_pair(parent, ast));
                 }
             }
         }
+        if (Requirements * reqs = enclosingRequirements())
+            reqs->VisitStmt(s);
         return true;
     }
 
@@ -260,7 +424,8 @@ class BuildTU
                               syn_ctx,
                               ci);
 
-            reqs.TraverseDecl(d);
+            if (!single_pass)
+                reqs.TraverseDecl(d);
             AstRef ast = makeAst(d, reqs);
             if (isa<NamedDecl>(d)) {
                 std::string name = static_cast<NamedDecl*>(d)->getNameAsString();
@@ -329,10 +494,8 @@ class BuildTU
             bool keep_going = base::TraverseStmt(s);
             // If we created a new node, remove it from the spine
             // now that the traversal of this Stmt is complete.
-            while (spine.size() > original_spine_size) {
-                spine.back()->expand_to_child_ranges();
-                spine.pop_back();
-            }
+            while (spine.size() > original_spine_size)
+                popSpine();
 
             if (begins_scope(s)) {
                 var_scopes.pop_back();
@@ -361,10 +524,8 @@ class BuildTU
             
             // If we created a new node, remove it from the spine
             // now that the traversal of this Decl is complete.
-            while (spine.size() > original_spine_size) {
-                spine.back()->expand_to_child_ranges();
-                spine.pop_back();
-            }
+            while (spine.size() > original_spine_size)
+                popSpine();
 
             if (begins_pseudoscope(d)) {
                 decl_scopes.exit_scope();
@@ -392,6 +553,7 @@ class BuildTU
     SourceManager & sm;
 
     std::vector<AstRef> spine;
+    std::vector<Requirements> pending;
 
     std::vector<VarScope> var_scopes;
     Scope & decl_scopes;
@@ -400,13 +562,17 @@ class BuildTU
     std::vector<std::pair<AstRef,AstRef> > functions;
     size_t decl_depth;
     bool with_cfg;
+    bool single_pass;
+    SourceOffset keep_body;
 };
 
 } // namespace clang_mutate
 
 std::unique_ptr<clang::ASTConsumer>
-clang_mutate::CreateTU(clang::CompilerInstance * CI, bool WithCfg)
+clang_mutate::CreateTU(clang::CompilerInstance * CI,
+                       bool WithCfg,
+                       SourceOffset KeepBody)
 {
     return std::unique_ptr<clang::ASTConsumer>
-        (new BuildTU(*tu_in_progress, CI, WithCfg));
+        (new BuildTU(*tu_in_progress, CI, WithCfg, KeepBody));
 }
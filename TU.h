@@ -11,40 +11,175 @@
 #include "clang/AST/ASTConsumer.h"
 
 #include <map>
+#include <memory>
+#include <set>
 #include <vector>
 
 namespace clang_mutate {
+
+class SourceHashes;
     
 struct TU
 {
     TU(TURef _tuid, clang::CompilerInstance* ci)
       : tuid(_tuid)
       , ci(ci)
+      , ast_arena()
       , asts()
       , addrMap()
       , llvmInstrMap()
+      , with_cfg(false)
     {}
     ~TU();
     TURef tuid;
+    // The compiler which built the TU. It is only valid while the TU is
+    // being built; see detach().
     clang::CompilerInstance * ci;
+    // The TU's Asts, in counter order. They are allocated from (and
+    // owned by) ast_arena; what they hold in containers is not (see
+    // the note in Ast.h).
+    Arena<Ast> ast_arena;
     std::vector<Ast*> asts;
     BinaryAddressMap addrMap;
     LLVMInstructionMap llvmInstrMap;
     bool allowDeclAsts;
     std::string source;
+    // Hashes of the source, for fingerprints of modified versions of
+    // it (see Fingerprint.h). Built on first use.
+    std::shared_ptr<const SourceHashes> source_hashes;
     Scope scopes;
     std::map<std::string, std::vector<picojson::value> > aux;
     std::map<AstRef, SourceOffset> function_starts;
-    std::string filename;
+    RenameTable renames;
+    Symbol filename;
+    // The entries of the (global) type database that this TU uses.
+    std::set<Hash> type_hashes;
+    std::shared_ptr<MacroDB> macros;
+    // For a TU read back from a cache, the storage behind its
+    // identifiers (see TUCache.h).
+    std::unique_ptr<char[]> identifiers;
+    // Absolute paths of the files read to build the TU: the main file
+    // and everything it #includes.
+    std::vector<std::string> dependencies;
+    // How the TU was built, so that it can be reparsed (see Reparse.h).
+    // A TU loaded from the cache has no invocation.
+    std::shared_ptr<clang::CompilerInvocation> invocation;
+    std::string directory;
+    bool with_cfg;
 
     AstRef nextAstRef() const;
+
+    // Copy what is still needed (the main file's source, its macros and
+    // the dependencies) out of the compiler which built the TU, then
+    // destroy the compiler, releasing the ASTContext, Preprocessor and
+    // SourceManager. Once detached, ci is NULL.
+    void detach();
+};
+
+// The loaded TUs, indexed by TURef. Every AstRef dereference goes
+// through this table, so it is a flat vector rather than a map. TU ids
+// are handed out in increasing order and never reused: the slot of a
+// TU which was unloaded (or never built) holds NULL from then on, and
+// an AstRef into it cannot reach a later TU.
+class TUTable
+{
+public:
+    // The TU with id `tuid`, or NULL if there is none. Unlike
+    // std::map::operator[], this never adds a slot.
+    TU * operator[](TURef tuid) const
+    { return tuid < m_slots.size() ? m_slots[tuid] : NULL; }
+
+    // The TU with id `tuid` (NULL if it has not been built yet).
+    // Throws std::out_of_range if the id was never reserved.
+    TU * at(TURef tuid) const
+    { return m_slots.at(tuid); }
+
+    bool contains(TURef tuid) const
+    { return (*this)[tuid] != NULL; }
+
+    // Add `count` empty slots, returning the id of the first.
+    TURef reserve(size_t count);
+
+    // Fill (or empty, if `tu` is NULL) the slot for `tuid`, which must
+    // have been reserved.
+    void set(TURef tuid, TU * tu)
+    { m_slots.at(tuid) = tu; }
+
+    void erase(TURef tuid)
+    { set(tuid, NULL); }
+
+    // Iteration visits the loaded TUs, as (id, TU) pairs in id order.
+    class const_iterator
+    {
+    public:
+        typedef std::pair<TURef, TU*> value_type;
+
+        const_iterator(const std::vector<TU*> & slots, TURef tuid)
+            : m_slots(&slots), m_value(tuid, NULL)
+        { skip(); }
+
+        const value_type & operator*() const { return m_value; }
+        const value_type * operator->() const { return &m_value; }
+
+        const_iterator & operator++()
+        { ++m_value.first; skip(); return *this; }
+
+        bool operator==(const const_iterator & that) const
+        { return m_value.first == that.m_value.first; }
+        bool operator!=(const const_iterator & that) const
+        { return !(*this == that); }
+    private:
+        void skip()
+        {
+            while (m_value.first < m_slots->size() &&
+                   (*m_slots)[m_value.first] == NULL)
+            {
+                ++m_value.first;
+            }
+            m_value.second = m_value.first < m_slots->size()
+                ? (*m_slots)[m_value.first]
+                : NULL;
+        }
+
+        const std::vector<TU*> * m_slots;
+        value_type m_value;
+    };
+
+    const_iterator begin() const { return const_iterator(m_slots, 0); }
+    const_iterator end() const
+    { return const_iterator(m_slots, m_slots.size()); }
+
+private:
+    std::vector<TU*> m_slots;
 };
 
-extern std::map<TURef, TU*> TUs;
+extern TUTable TUs;
+
+// Reserve `count` consecutive TU ids, returning the first. The ids get
+// slots in TUs right away (with no TU yet), so that registering the
+// TUs later does not resize the table.
+TURef reserveTURefs(size_t count);
+
+// Fill in a reserved slot of TUs. TUs may be registered from several
+// threads at once, provided that their slots were reserved beforehand.
+void registerTU(TU * tu);
+
+// The TU currently being built by this thread.
+extern thread_local TU * tu_in_progress;
+
+// When set, BuildTU gathers each AST's requirements (free variables
+// and functions, includes, macros and types) from the nodes it visits
+// and merges them upward along the spine, instead of running a fresh
+// Requirements traversal over every subtree.
+extern bool single_pass_requirements;
 
-extern TU * tu_in_progress;
+// Build tu_in_progress. When function bodies are being skipped (see
+// clang::FrontendOptions::SkipFunctionBodies), the body of the function
+// which begins at KeepBody is not.
 std::unique_ptr<clang::ASTConsumer>
-CreateTU(clang::CompilerInstance * CI, bool WithCfg=false);
+CreateTU(clang::CompilerInstance * CI,
+         bool WithCfg=false,
+         SourceOffset KeepBody=BadOffset);
 
 } // end namespace clang_mutate
 
@@ -0,0 +1,259 @@
+#include "TUCache.h"
+#include "AuxDB.h"
+#include "Macros.h"
+#include "Serialization.h"
+#include "TypeDBEntry.h"
+#include "Utils.h"
+
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <stdio.h>
+
+#include <chrono>
+#include <iomanip>
+#include <mutex>
+#include <sstream>
+
+namespace clang_mutate {
+using namespace clang;
+
+std::string tu_cache_dir;
+
+static const char * const SnapshotMagic = "clang-mutate TU snapshot";
+
+// Bump this whenever the snapshot format (or anything that goes into
+// a TU) changes, so that stale snapshots are ignored.
+static const uint64_t SnapshotVersion = 3;
+
+static std::mutex stats_mutex;
+static TUCacheStats stats;
+
+TUCacheStats tu_cache_stats()
+{
+    std::lock_guard<std::mutex> lock(stats_mutex);
+    return stats;
+}
+
+static std::string absolute_path(const std::string & directory,
+                                 const std::string & path)
+{
+    if (llvm::sys::path::is_absolute(path))
+        return path;
+    llvm::SmallString<256> ans(directory);
+    llvm::sys::path::append(ans, path);
+    return ans.str();
+}
+
+// 64-bit FNV-1a. Unlike std::hash, its value does not depend on the
+// compiler clang-mutate was built with, so that runs built differently
+// can share a cache directory.
+static uint64_t fnv1a(const std::string & text)
+{
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (unsigned char c : text) {
+        hash ^= c;
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+static uint64_t content_hash(const std::string & path)
+{ return fnv1a(Utils::filenameToContents(path)); }
+
+static std::string snapshot_path(const std::string & key)
+{ return tu_cache_dir + "/" + key + ".tu"; }
+
+std::string tu_cache_key(const tooling::CompileCommand & command,
+                         bool with_cfg)
+{
+    std::ostringstream material;
+    material << SnapshotVersion << '\0'
+             << command.Directory << '\0'
+             << command.Filename << '\0';
+    for (auto & arg : command.CommandLine)
+        material << arg << '\0';
+    material << (with_cfg ? "cfg" : "") << '\0'
+             << Utils::filenameToContents(
+                    absolute_path(command.Directory, command.Filename));
+
+    std::ostringstream key;
+    key << std::hex << std::setfill('0') << std::setw(16)
+        << fnv1a(material.str());
+    return key.str();
+}
+
+TU * load_cached_tu(const std::string & key, TURef tuid)
+{
+    auto start = std::chrono::steady_clock::now();
+    TU * tu = NULL;
+
+    std::string data = Utils::filenameToContents(snapshot_path(key));
+    BinaryReader in(data, tuid);
+
+    bool valid = in.get_string() == SnapshotMagic
+        && in.get_uint() == SnapshotVersion
+        && in.get_string() == key;
+
+    // The snapshot is stale if any of the TU's files has changed.
+    for (size_t n = valid ? in.get_uint() : 0; n > 0 && valid; --n) {
+        std::string path = in.get_string();
+        valid = content_hash(path) == in.get_uint() && !in.fail();
+    }
+
+    if (valid) {
+        tu = new TU(tuid, NULL);
+        tu->filename = Symbol(in.get_string());
+        tu->source = in.get_string();
+
+        // Stand-ins for the original IdentifierInfos. They are never
+        // dereferenced, but are ordered like the originals so that
+        // sets of variables and functions keep their order.
+        size_t num_identifiers = in.get_uint();
+        if (in.fail() || num_identifiers > data.size())
+            valid = false;
+        else {
+            tu->identifiers.reset(new char[num_identifiers + 1]);
+            std::vector<const IdentifierInfo*> handles;
+            for (size_t i = 0; i < num_identifiers; ++i)
+                handles.push_back(reinterpret_cast<const IdentifierInfo*>(
+                                      tu->identifiers.get() + i));
+            in.setIdentifiers(handles);
+        }
+
+        tu->renames.read(in);
+        for (size_t n = valid ? in.get_uint() : 0; n > 0 && valid; --n) {
+            Ast * ast = Ast::read(in, tu->ast_arena);
+            if (ast == NULL)
+                valid = false;
+            else
+                tu->asts.push_back(ast);
+        }
+        tu->scopes.read(in);
+
+        for (size_t n = valid ? in.get_uint() : 0; n > 0 && !in.fail(); --n) {
+            AstRef body = in.get_astref();
+            tu->function_starts[body] = in.get_signed();
+        }
+
+        for (size_t n = valid ? in.get_uint() : 0; n > 0 && !in.fail(); --n) {
+            std::vector<picojson::value> & entries = tu->aux[in.get_string()];
+            for (size_t m = in.get_uint(); m > 0 && !in.fail(); --m) {
+                entries.push_back(picojson::value());
+                picojson::parse(entries.back(), in.get_string());
+            }
+        }
+
+        std::vector<TypeDBEntry> types;
+        for (size_t n = valid ? in.get_uint() : 0; n > 0 && !in.fail(); --n)
+            types.push_back(TypeDBEntry::read(in));
+        tu->macros = MacroDB::read(in);
+
+        valid = valid && !in.fail() && in.done();
+        if (valid) {
+            for (auto & type : types) {
+                tu->type_hashes.insert(type.hash());
+                TypeDBEntry::restore(type);
+            }
+        }
+        else {
+            delete tu;
+            tu = NULL;
+        }
+    }
+
+    if (tu != NULL)
+        registerTU(tu);
+
+    std::chrono::duration<double> elapsed
+        = std::chrono::steady_clock::now() - start;
+    std::lock_guard<std::mutex> lock(stats_mutex);
+    if (tu != NULL) {
+        ++stats.hits;
+        stats.load_seconds += elapsed.count();
+    }
+    else {
+        ++stats.misses;
+    }
+    return tu;
+}
+
+bool save_cached_tu(const std::string & key, const TU & tu)
+{
+    if (tu.dependencies.empty())
+        return false;
+
+    std::string data;
+    BinaryWriter out(data);
+    out.put(std::string(SnapshotMagic));
+    out.put(SnapshotVersion);
+    out.put(key);
+
+    out.put(uint64_t(tu.dependencies.size()));
+    for (auto & path : tu.dependencies) {
+        out.put(path);
+        out.put(content_hash(path));
+    }
+
+    out.put(tu.filename.str());
+    out.put(tu.source);
+
+    std::set<const IdentifierInfo*> ids;
+    tu.renames.collectIdentifiers(ids);
+    for (auto & ast : tu.asts)
+        ast->collectIdentifiers(ids);
+    out.setIdentifiers(std::vector<const IdentifierInfo*>(ids.begin(),
+                                                          ids.end()));
+    out.put(uint64_t(ids.size()));
+
+    tu.renames.write(out);
+    out.put(uint64_t(tu.asts.size()));
+    for (auto & ast : tu.asts)
+        ast->write(out);
+    tu.scopes.write(out);
+
+    out.put(uint64_t(tu.function_starts.size()));
+    for (auto & entry : tu.function_starts) {
+        out.put(entry.first);
+        out.put_signed(entry.second);
+    }
+
+    out.put(uint64_t(tu.aux.size()));
+    for (auto & entry : tu.aux) {
+        out.put(entry.first);
+        out.put(uint64_t(entry.second.size()));
+        for (auto & value : entry.second)
+            out.put(value.serialize());
+    }
+
+    out.put(uint64_t(tu.type_hashes.size()));
+    for (auto & hash : tu.type_hashes)
+        TypeDBEntry::find_type(hash).write(out);
+    tu.macros->write(out);
+
+    // Write to a temporary file of our own first, so that concurrent
+    // runs (in this process or another) never see a partial snapshot.
+    if (llvm::sys::fs::create_directories(tu_cache_dir))
+        return false;
+    int fd;
+    llvm::SmallString<256> tmp;
+    if (llvm::sys::fs::createUniqueFile(snapshot_path(key) + ".tmp%%%%%%%%",
+                                        fd, tmp))
+    {
+        return false;
+    }
+    {
+        llvm::raw_fd_ostream f(fd, /*shouldClose=*/true);
+        f.write(data.data(), data.size());
+        f.close();
+        if (f.has_error()) {
+            f.clear_error();
+            remove(tmp.c_str());
+            return false;
+        }
+    }
+    return rename(tmp.c_str(), snapshot_path(key).c_str()) == 0;
+}
+
+} // end namespace clang_mutate
@@ -0,0 +1,48 @@
+#ifndef CLANG_MUTATE_TU_CACHE_H
+#define CLANG_MUTATE_TU_CACHE_H
+
+// An on-disk cache of built TUs. A snapshot holds everything that
+// clang-mutate keeps once a TU has been built (the ASTs, scopes,
+// renaming sites, auxiliary entries, and the type and macro databases
+// that the TU uses), so that loading it skips the clang parse
+// entirely. Snapshots are keyed on the compile command and the main
+// file's contents, and are only used if none of the files the TU
+// depends on (the main file and everything it #includes) has changed.
+
+#include "TU.h"
+
+#include "clang/Tooling/CompilationDatabase.h"
+
+#include <string>
+
+namespace clang_mutate {
+
+// The directory holding the snapshots; caching is disabled if empty.
+extern std::string tu_cache_dir;
+
+struct TUCacheStats
+{
+    TUCacheStats() : hits(0), misses(0), load_seconds(0) {}
+    size_t hits;
+    size_t misses;
+    double load_seconds;
+};
+
+TUCacheStats tu_cache_stats();
+
+// The cache key for a TU built from `command`.
+std::string tu_cache_key(const clang::tooling::CompileCommand & command,
+                         bool with_cfg);
+
+// Load and register the TU cached under `key` as `tuid`, which must
+// have been reserved with reserveTURefs. Returns NULL (and counts a
+// miss) if there is no valid snapshot.
+TU * load_cached_tu(const std::string & key, TURef tuid);
+
+// Save a snapshot of `tu`, which must have been built (not loaded from
+// the cache), so that its dependencies are known.
+bool save_cached_tu(const std::string & key, const TU & tu);
+
+} // end namespace clang_mutate
+
+#endif
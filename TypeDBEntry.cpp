@@ -5,6 +5,8 @@
 #include "clang/Lex/Lexer.h"
 #include "clang/Lex/Preprocessor.h"
 
+#include <mutex>
+
 using namespace clang_mutate;
 using namespace clang;
 
@@ -64,14 +66,19 @@ uint64_t get_type_size(ASTContext * context, const Type * t)
     return context->getTypeSize(t);
 }
 
+// QualTypes are only meaningful within the ASTContext of the TU
+// being built, and each TU is built by a single thread.
+static thread_local std::map<QualType, Hash, QualTypeComparator> seen;
+
+void clang_mutate::clear_type_cache()
+{ seen.clear(); }
+
 static Hash define_type(
     QualType t,
     StorageClass sc,
     CompilerInstance * ci,
     ASTContext *context)
 {
-    static std::map<QualType, Hash, QualTypeComparator> seen;
-
     if (t.getTypePtrOrNull() == NULL)
         return 0;
 
@@ -533,6 +540,14 @@ Hash clang_mutate::hash_type(const QualType & t, CompilerInstance * ci,
 
 std::map<Hash, TypeDBEntry> TypeDBEntry::type_db;
 
+// Guards type_db, which is shared by TUs built on different threads.
+static std::mutex type_db_mutex;
+
+static thread_local std::set<Hash> * type_db_recorder = NULL;
+
+void TypeDBEntry::setRecorder(std::set<Hash> * recorder)
+{ type_db_recorder = recorder; }
+
 TypeDBEntry TypeDBEntry::mkType(const std::string & _name,
                                 const uint64_t & _size,
                                 const bool & _pointer,
@@ -626,6 +641,9 @@ TypeDBEntry TypeDBEntry::mkInclude(const std::string & _name,
 
 TypeDBEntry TypeDBEntry::find_type(Hash hash)
 {
+    if (type_db_recorder)
+        type_db_recorder->insert(hash);
+    std::lock_guard<std::mutex> lock(type_db_mutex);
     return type_db[hash];
 }
 
@@ -658,9 +676,59 @@ void TypeDBEntry::compute_hash()
     }
 
     m_hash = h;
-    if (type_db.find(m_hash) != type_db.end())
+    restore(*this);
+}
+
+void TypeDBEntry::restore(const TypeDBEntry & entry)
+{
+    if (type_db_recorder)
+        type_db_recorder->insert(entry.m_hash);
+    std::lock_guard<std::mutex> lock(type_db_mutex);
+    if (type_db.find(entry.m_hash) != type_db.end())
         return;
-    type_db[m_hash] = *this;
+    type_db[entry.m_hash] = entry;
+}
+
+void TypeDBEntry::write(BinaryWriter & out) const
+{
+    out.put(m_name);
+    out.put(uint64_t(m_size));
+    out.put(m_pointer);
+    out.put(m_const);
+    out.put(m_volatile);
+    out.put(m_restrict);
+    out.put(m_storage_class);
+    out.put(m_array_size);
+    out.put(m_text);
+    out.put(m_file);
+    out.put(uint64_t(m_line));
+    out.put(uint64_t(m_col));
+    out.put(m_ifile);
+    out.put(m_reqs);
+    out.put(m_hash);
+}
+
+TypeDBEntry TypeDBEntry::read(BinaryReader & in)
+{
+    TypeDBEntry ti;
+    ti.m_name = in.get_string();
+    ti.m_size = in.get_uint();
+    ti.m_pointer = in.get_bool();
+    ti.m_const = in.get_bool();
+    ti.m_volatile = in.get_bool();
+    ti.m_restrict = in.get_bool();
+    ti.m_storage_class = in.get_string();
+    ti.m_array_size = in.get_string();
+    ti.m_text = in.get_string();
+    ti.m_file = in.get_string();
+    ti.m_line = in.get_uint();
+    ti.m_col = in.get_uint();
+    ti.m_ifile = in.get_string();
+    size_t n = in.get_uint();
+    for (size_t i = 0; i < n && !in.fail(); ++i)
+        ti.m_reqs.insert(in.get_hash());
+    ti.m_hash = in.get_hash();
+    return ti;
 }
 
 picojson::value TypeDBEntry::toJSON() const
@@ -697,6 +765,7 @@ picojson::value TypeDBEntry::toJSON() const
 picojson::array TypeDBEntry::databaseToJSON()
 {
     picojson::array array;
+    std::lock_guard<std::mutex> lock(type_db_mutex);
     for (std::map<Hash, TypeDBEntry>::iterator it = type_db.begin();
          it != type_db.end();
          ++it)
@@ -3,6 +3,7 @@
 
 #include "Utils.h"
 #include "Json.h"
+#include "Serialization.h"
 
 #include "clang/Basic/LLVM.h"
 #include "clang/Basic/SourceManager.h"
@@ -78,6 +79,18 @@ public:
     picojson::value toJSON() const;
     static picojson::array databaseToJSON();
 
+    // While a recorder is set, the hash of every type defined or looked
+    // up on this thread is added to it. This lets a TU remember which
+    // parts of the shared database it relies on.
+    static void setRecorder(std::set<Hash> * recorder);
+
+    // Add an entry (read back from a cache) to the database, unless an
+    // entry with the same hash is already present.
+    static void restore(const TypeDBEntry & entry);
+
+    void write(BinaryWriter & out) const;
+    static TypeDBEntry read(BinaryReader & in);
+
 private:
     void compute_hash();
 
@@ -108,6 +121,11 @@ Hash hash_type(const clang::QualType & t,
                clang::CompilerInstance * ci,
                clang::ASTContext *context);
 
+// Forget the types hashed so far on this thread. Must be called before
+// building each TU, since a new ASTContext may reuse the addresses of
+// types from one which has been destroyed.
+void clear_type_cache();
+
 } // end namespace clang_mutate
 
 template <> inline
@@ -3,6 +3,7 @@
 
 #include <algorithm>
 #include <fstream>
+#include <mutex>
 #include <sstream>
 
 using namespace clang_mutate;
@@ -12,7 +13,9 @@ namespace Utils {
 
 std::string safe_realpath(const std::string & filename)
 {
+    static std::mutex cache_mutex;
     static std::unordered_map<std::string, std::string> cache;
+    std::lock_guard<std::mutex> lock(cache_mutex);
     auto search = cache.find(filename);
 
     if (search == cache.end()) {
@@ -560,27 +563,28 @@ bool is_function_decl(AstRef ast, CompilerInstance const& ci)
 
 bool is_full_stmt(Stmt * stmt, AstRef parent, CompilerInstance const& ci)
 {
-    std::string parentClass = parent->className();
-    std::string stmtClass = std::string(stmt->getStmtClassName());
+    using namespace clang_mutate;
+    Symbol parentClass = parent->className();
+    bool isCompound = isa<CompoundStmt>(stmt);
 
-    return (parentClass == "CompoundStmt" && stmtClass != "CompoundStmt")
-        || parentClass == "LabelStmt"
-        || (is_function_decl(parent, ci) && stmtClass == "CompoundStmt")
+    return (parentClass == AstClass::CompoundStmt && !isCompound)
+        || parentClass == AstClass::LabelStmt
+        || (is_function_decl(parent, ci) && isCompound)
         // The first child of a CaseStmt is the condition. The rest are full
         // statements.
-        || (parentClass == "CaseStmt" &&
+        || (parentClass == AstClass::CaseStmt &&
             // If stmt is first child, it may not have been added to parent yet
             parent->children().size() > 0 &&
             stmt != parent->children()[0]->asStmt(ci))
-        || (parentClass == "DoStmt" && stmtClass != "CompoundStmt" &&
+        || (parentClass == AstClass::DoStmt && !isCompound &&
             stmt == static_cast<DoStmt*>(parent->asStmt(ci))->getBody())
-        || (parentClass == "ForStmt" && stmtClass != "CompoundStmt" &&
+        || (parentClass == AstClass::ForStmt && !isCompound &&
             stmt == static_cast<ForStmt*>(parent->asStmt(ci))->getBody())
-        || (parentClass == "CXXForRangeStmt" && stmtClass != "CompoundStmt" &&
+        || (parentClass == AstClass::CXXForRangeStmt && !isCompound &&
             stmt == static_cast<CXXForRangeStmt*>(parent->asStmt(ci))->getBody())
-        || (parentClass == "WhileStmt" && stmtClass != "CompoundStmt" &&
+        || (parentClass == AstClass::WhileStmt && !isCompound &&
             stmt == static_cast<WhileStmt*>(parent->asStmt(ci))->getBody())
-        || (parentClass == "IfStmt" && stmtClass != "CompoundStmt" &&
+        || (parentClass == AstClass::IfStmt && !isCompound &&
             (stmt == static_cast<IfStmt*>(parent->asStmt(ci))->getThen() ||
              stmt == static_cast<IfStmt*>(parent->asStmt(ci))->getElse()));
 }
@@ -10,6 +10,19 @@ VariableInfo::VariableInfo(const IdentifierInfo * _ident)
     name = ident->getName().str();
 }
 
+void VariableInfo::write(clang_mutate::BinaryWriter & out) const
+{
+    out.put(ident);
+    out.put(name);
+}
+
+VariableInfo VariableInfo::read(clang_mutate::BinaryReader & in)
+{
+    const IdentifierInfo * ident = in.get_identifier();
+    std::string name = in.get_string();
+    return VariableInfo(ident, name);
+}
+
 picojson::value VariableInfo::toJSON() const
 {
     std::ostringstream oss;
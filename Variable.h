@@ -1,6 +1,7 @@
 #ifndef CLANG_MUTATE_VARIABLE_H
 #define CLANG_MUTATE_VARIABLE_H
 
+#include "Serialization.h"
 #include "Utils.h"
 
 #include "clang/AST/AST.h"
@@ -11,6 +12,12 @@ class VariableInfo
 public:
     VariableInfo(const clang::IdentifierInfo * _ident);
 
+    VariableInfo(const clang::IdentifierInfo * _ident,
+                 const std::string & _name)
+        : ident(_ident)
+        , name(_name)
+    {}
+
     VariableInfo(const VariableInfo & that)
         : ident(that.ident)
         , name(that.name)
@@ -26,6 +33,9 @@ public:
     { return ident < that.ident; }
     
     picojson::value toJSON() const;
+
+    void write(clang_mutate::BinaryWriter & out) const;
+    static VariableInfo read(clang_mutate::BinaryReader & in);
     
 private:
     const clang::IdentifierInfo * ident;
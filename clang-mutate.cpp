@@ -13,8 +13,11 @@
 //
 //===----------------------------------------------------------------------===//
 #include "clang-mutate.h"
+#include "Batch.h"
 #include "Interactive.h"
+#include "Output.h"
 #include "FAF.h"
+#include "TUCache.h"
 #include "Utils.h"
 
 #include "clang/AST/ASTConsumer.h"
@@ -24,9 +27,16 @@
 #include "clang/Tooling/CommonOptionsParser.h"
 #include "clang/Tooling/Tooling.h"
 #include "llvm/Support/CommandLine.h"
+#include "llvm/Support/Format.h"
 
+#include <algorithm>
+#include <atomic>
 #include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
 #include <sstream>
+#include <thread>
 
 using namespace clang::driver;
 using namespace clang::tooling;
@@ -60,6 +70,9 @@ OPTION( Ids         , bool        , "ids"          , "print count of statement i
 OPTION( Annotate    , bool        , "annotate"     , "annotate each statement with its class");
 OPTION( List        , bool        , "list"         , "list every statement's id, class, and range");
 OPTION( Json        , bool        , "json"         , "list JSON-encoded descriptions for every statement.");
+OPTION( Jsonl       , bool        , "jsonl"        , "list JSON-encoded descriptions for every statement, one per line.");
+OPTION( Packed      , bool        , "packed"       , "write the descriptions -json would list as a compact binary stream.");
+OPTION( Columns     , std::string , "columns"      , "write the -fields of every statement to the given file as columns");
 OPTION( Sexp        , bool        , "sexp"         , "list s-expression encoded descriptions for every statement.");
 OPTION( Cut         , bool        , "cut"          , "cut stmt1");
 OPTION( Insert      , bool        , "insert"       , "copy stmt1 to before stmt2");
@@ -84,197 +97,334 @@ OPTION( Binary      , std::string , "binary"       , "binary with DWARF informat
 OPTION( DwarfFilepathMap, std::string, "dwarf-filepath-mapping", "mapping of filepaths used in compilation -> new filepath");
 OPTION( LLVMIR      , std::string , "llvm_ir"      , "llvm-ir with debug information for line->instruction mapping");
 OPTION( Cfg         , bool        , "cfg"          , "include control-flow information in ASTs");
+OPTION( SinglePassReqs, bool      , "single-pass-reqs", "compute AST requirements in a single bottom-up pass");
+OPTION( Jobs        , unsigned int, "j"            , "number of source files to parse (or -batch variants to apply) in parallel");
+OPTION( SerializeJobs, unsigned int, "serialize-jobs", "number of threads with which to serialize ASTs for -json, -jsonl and -sexp");
+OPTION( CacheDir    , std::string , "cache-dir"    , "directory in which to cache parsed translation units");
+OPTION( Batch       , std::string , "batch"        , "JSON Lines manifest of mutations to apply, one variant each");
+OPTION( Output      , std::string , "output"       , "file to which to write output instead of stdout");
+OPTION( Compress    , std::string , "compress"     , "compression for -output: none, gzip or zstd (default: by extension)");
+OPTION( Diff        , bool        , "diff"         , "print a unified diff instead of the whole modified source");
 
 std::ostringstream MutateCmd;
 
+// Commands for each TU, in the order the TUs should be processed.
+std::map<clang_mutate::TURef, std::string> TUCmds;
+std::mutex TUCmdsMutex;
+
 namespace {
-class ActionFactory : public SourceFileCallbacks {
-public:
+// Queue the commands requested on the command line for the TU `tuid`.
+// Returns true if the TU should be built with control-flow information.
+bool queue_commands(std::ostream & Cmd, clang_mutate::TURef tuid)
+{
+    // How to show the modified source.
+    const char * show = Diff ? "diff " : "preview ";
 
-    virtual bool handleBeginSource(clang::CompilerInstance & CIref)
-    {
-        CI = &CIref;
-        return SourceFileCallbacks::handleBeginSource(CIref);
+    if (!Binary.empty()) {
+        Cmd << "binary " << tuid << " " << Binary
+            << " " << DwarfFilepathMap << std::endl;
     }
 
-    std::unique_ptr<clang::ASTConsumer> newASTConsumer() {
-        if (!Binary.empty()) {
-            MutateCmd << "binary 0 " << Binary
-                      << " " << DwarfFilepathMap << std::endl;
-        }
+    if (!LLVMIR.empty()) {
+        Cmd << "llvm_ir " << tuid << " " << LLVMIR << std::endl;
+    }
+
+    if (Number) {
+        Cmd << "number " << tuid << std::endl
+            << show << tuid << std::endl;
+        return false;
+    }
+    if (NumberF) {
+        Cmd << "number-full " << tuid << std::endl
+            << show << tuid << std::endl;
+        return false;
+    }
+    if (Ids) {
+        Cmd << "ids " << tuid << std::endl;
+        return false;
+    }
+    if (Annotate) {
+        Cmd << "annotate " << tuid << std::endl
+            << show << tuid << std::endl;
+        return false;
+    }
+
+    if (List) {
+        Cmd << "list " << tuid << std::endl;
+        return false;
+    }
 
-        if (!LLVMIR.empty()) {
-            MutateCmd << "llvm_ir 0 " << LLVMIR << std::endl;
+    if (!Batch.empty()) {
+        Cmd << "batch " << tuid << " " << Utils::escape(Batch) << std::endl;
+        return false;
+    }
+
+    if (!Columns.empty()) {
+        Cmd << "columns " << tuid << " " << Utils::escape(Columns);
+        if (!Fields.empty()) {
+            std::string sep = "";
+            Cmd << " fields=";
+            for (auto & key : Utils::split(Fields, ',')) {
+                Cmd << sep << key;
+                sep = ",";
+            }
         }
+        Cmd << std::endl;
+        return Cfg;
+    }
 
-        if (!File1.empty()) {
-            Value1 = Utils::filenameToContents(File1);
+    if (Json || Jsonl || Packed) {
+        // A single statement is still wrapped in an array for -json;
+        // for -jsonl it is just one line. -packed always writes the
+        // whole TU.
+        if (Stmt1 && !Packed) {
+            if (Json)
+                Cmd << "echo [" << std::endl;
+            Cmd << "ast " << tuid << "." << Stmt1;
         }
-        if (!File2.empty()) {
-            Value2 = Utils::filenameToContents(File2);
+        else {
+            Cmd << (Packed ? "packed " : Jsonl ? "jsonl " : "json ") << tuid;
         }
-
-        if (Number) {
-            MutateCmd << "number 0" << std::endl
-                      << "preview 0" << std::endl;
-            return clang_mutate::CreateTU(CI);
+        if (!Aux.empty()) {
+            std::string sep = "";
+            Cmd << " aux=";
+            for (auto & aux : Utils::split(Aux, ',')) {
+                Cmd << sep << aux;
+                sep = ",";
+            }
         }
-        if (NumberF) {
-            MutateCmd << "number-full 0" << std::endl
-                      << "preview 0" << std::endl;
-            return clang_mutate::CreateTU(CI);
+        if (!Fields.empty()) {
+            std::string sep = "";
+            Cmd << " fields=";
+            for (auto & key : Utils::split(Fields, ',')) {
+                Cmd << sep << key;
+                sep = ",";
+            }
         }
-        if (Ids) {
-            MutateCmd << "ids 0" << std::endl;
-            return clang_mutate::CreateTU(CI);
+        Cmd << std::endl;
+        if (Stmt1 && Json && !Packed) {
+            Cmd << "echo ]" << std::endl;
         }
-        if (Annotate) {
-            MutateCmd << "annotate 0" << std::endl
-                      << "preview 0" << std::endl;
-            return clang_mutate::CreateTU(CI);
+        return Cfg;
+    }
+    if (Sexp) {
+        if (Stmt1) {
+            Cmd << "echo [" << std::endl;
+            Cmd << "ast " << tuid << "." << Stmt1;
         }
-
-        if (List) {
-            MutateCmd << "list 0" << std::endl;
-            return clang_mutate::CreateTU(CI);
+        else {
+            Cmd << "sexp " << tuid;
         }
-
-        if (Json) {
-            if (Stmt1) {
-                MutateCmd << "echo [" << std::endl;
-                MutateCmd << "ast 0." << Stmt1;
+        if (!Aux.empty()) {
+            std::string sep = "";
+            Cmd << " aux=";
+            for (auto & aux : Utils::split(Aux, ',')) {
+                Cmd << sep << aux;
+                sep = ",";
             }
-            else {
-                MutateCmd << "json 0";
-            }
-            if (!Aux.empty()) {
-                std::string sep = "";
-                MutateCmd << " aux=";
-                for (auto & aux : Utils::split(Aux, ',')) {
-                    MutateCmd << sep << aux;
-                    sep = ",";
-                }
-            }
-            if (!Fields.empty()) {
-                std::string sep = "";
-                MutateCmd << " fields=";
-                for (auto & key : Utils::split(Fields, ',')) {
-                    MutateCmd << sep << key;
-                    sep = ",";
-                }
-            }
-            MutateCmd << std::endl;
-            if (Stmt1) {
-                MutateCmd << "echo ]" << std::endl;
-            }
-            return clang_mutate::CreateTU(CI, Cfg);
         }
-        if (Sexp) {
-            if (Stmt1) {
-                MutateCmd << "echo [" << std::endl;
-                MutateCmd << "ast 0." << Stmt1;
+        if (!Fields.empty()) {
+            std::string sep = "";
+            Cmd << " fields=";
+            for (auto & key : Utils::split(Fields, ',')) {
+                Cmd << sep << key;
+                sep = ",";
             }
-            else {
-                MutateCmd << "sexp 0";
+        }
+        Cmd << std::endl;
+        if (Stmt1) {
+            Cmd << "echo ]" << std::endl;
+        }
+        return Cfg;
+    }
+    if (Cut) {
+        Cmd << "cut " << tuid << "." << Stmt1 << std::endl
+            << show << tuid << std::endl;
+        return false;
+    }
+    if (SetRange) {
+        Cmd << "set-range "
+            << tuid << "." << Stmt1 << " "
+            << tuid << "." << Stmt2 << " "
+            << Utils::escape(Value1) << std::endl
+            << show << tuid << std::endl;
+        return false;
+    }
+    if (SetFunc) {
+        Cmd << "set-func "
+            << tuid << "." << Stmt1 << " "
+            << Utils::escape(Value1) << std::endl
+            << show << tuid << std::endl;
+        return false;
+    }
+    if (Insert) {
+        Cmd << "get    " << tuid << "." << Stmt1 << " as $stmt" << std::endl
+            << "insert " << tuid << "." << Stmt2 << " $stmt" << std::endl
+            << show << tuid << std::endl;
+        return false;
+    }
+    if (Swap) {
+        Cmd << "swap " << tuid << "." << Stmt1
+            << " " << tuid << "." << Stmt2 << std::endl
+            << show << tuid << std::endl;
+        return false;
+    }
+    if (Set) {
+        Cmd << "set " << tuid << "." << Stmt1 << " "
+            << Utils::escape(Value1) << std::endl
+            << show << tuid << std::endl;
+        return false;
+    }
+    if (Set2) {
+        Cmd << "set "
+            << tuid << "." << Stmt1 << " " << Utils::escape(Value1) << " "
+            << tuid << "." << Stmt2 << " " << Utils::escape(Value2)
+            << std::endl
+            << show << tuid << std::endl;
+        return false;
+    }
+    if (InsertV) {
+        Cmd << "insert " << tuid << "." << Stmt1 << " "
+            << Utils::escape(Value1) << std::endl
+            << show << tuid << std::endl;
+        return false;
+    }
+    if (Interactive) {
+        return false;
+    }
+    
+    errs() << "Must supply one of:\n";
+    errs() << "\tnumber\n";
+    errs() << "\tids\n";
+    errs() << "\tannotate\n";
+    errs() << "\tlist\n";
+    errs() << "\tcut\n";
+    errs() << "\tinsert\n";
+    errs() << "\tswap\n";
+    errs() << "\tget\n";
+    errs() << "\tset\n";
+    errs() << "\tset2\n";
+    errs() << "\tset-range\n";
+    errs() << "\tinsert-value\n";
+    errs() << "\tinteractive\n";
+    
+    exit(EXIT_FAILURE);
+}
+
+class ActionFactory : public SourceFileCallbacks {
+public:
+
+    virtual bool handleBeginSource(clang::CompilerInstance & CIref)
+    {
+        CI = &CIref;
+        return SourceFileCallbacks::handleBeginSource(CIref);
+    }
+
+    // Collect the commands for each TU separately, so that they can
+    // be run in TU order however the TUs were scheduled.
+    virtual void handleEndSource()
+    {
+        std::lock_guard<std::mutex> lock(TUCmdsMutex);
+        TUCmds[clang_mutate::tu_in_progress->tuid] = Cmd.str();
+        Cmd.str("");
+    }
+
+    std::unique_ptr<clang::ASTConsumer> newASTConsumer() {
+        bool with_cfg = queue_commands(Cmd, clang_mutate::tu_in_progress->tuid);
+        return clang_mutate::CreateTU(CI, with_cfg);
+    }
+
+  clang::CompilerInstance * CI;
+  std::ostringstream Cmd;
+};
+}
+
+namespace {
+// Parse `paths` on `jobs` worker threads, each with its own
+// ActionFactory, loading TUs from the cache where possible. TU ids are
+// reserved up front in path order, so the TUs are numbered exactly as
+// they would be by a serial run. The compile commands are run by FAF
+// rather than ClangTool, so that none of them changes the working
+// directory of the process under the others.
+int run_jobs(const CompilationDatabase & compilations,
+             const std::vector<std::string> & paths,
+             unsigned int jobs)
+{
+    std::vector<std::vector<CompileCommand> > commands;
+    std::vector<clang_mutate::TURef> first_tuids;
+    for (auto & path : paths) {
+        commands.push_back(
+            compilations.getCompileCommands(getAbsolutePath(path)));
+        first_tuids.push_back(
+            clang_mutate::reserveTURefs(commands.back().size()));
+    }
+
+    std::vector<int> results(paths.size(), 0);
+    std::atomic<size_t> next_path(0);
+    auto worker = [&]() {
+        ActionFactory Factory;
+        size_t i;
+        while ((i = next_path++) < paths.size()) {
+            if (commands[i].empty()) {
+                errs() << "Skipping " << paths[i]
+                       << ". Compile command not found.\n";
+                results[i] = 2;
             }
-            if (!Aux.empty()) {
-                std::string sep = "";
-                MutateCmd << " aux=";
-                for (auto & aux : Utils::split(Aux, ',')) {
-                    MutateCmd << sep << aux;
-                    sep = ",";
+            for (size_t j = 0; j < commands[i].size(); ++j) {
+                const CompileCommand & command = commands[i][j];
+                clang_mutate::TURef tuid = first_tuids[i] + j;
+                std::string key;
+                if (!clang_mutate::tu_cache_dir.empty()) {
+                    key = clang_mutate::tu_cache_key(command, Cfg);
+                    if (clang_mutate::load_cached_tu(key, tuid)) {
+                        std::ostringstream Cmd;
+                        queue_commands(Cmd, tuid);
+                        std::lock_guard<std::mutex> lock(TUCmdsMutex);
+                        TUCmds[tuid] = Cmd.str();
+                        continue;
+                    }
                 }
-            }
-            if (!Fields.empty()) {
-                std::string sep = "";
-                MutateCmd << " fields=";
-                for (auto & key : Utils::split(Fields, ',')) {
-                    MutateCmd << sep << key;
-                    sep = ",";
+
+                auto faf = newFAF<ActionFactory>(&Factory, &Factory);
+                faf->useReservedTURefs(tuid);
+                if (!faf->runCommand(command)) {
+                    errs() << "Error while processing " << paths[i]
+                           << ".\n";
+                    results[i] = 1;
+                    continue;
                 }
+                clang_mutate::TU * tu = clang_mutate::TUs.at(tuid);
+                if (tu != NULL && !key.empty())
+                    clang_mutate::save_cached_tu(key, *tu);
             }
-            MutateCmd << std::endl;
-            if (Stmt1) {
-                MutateCmd << "echo ]" << std::endl;
-            }
-            return clang_mutate::CreateTU(CI, Cfg);
-        }
-        if (Cut) {
-            MutateCmd << "cut 0." << Stmt1 << std::endl
-                      << "preview 0" << std::endl;
-            return clang_mutate::CreateTU(CI);
-        }
-        if (SetRange) {
-            MutateCmd << "set-range "
-                      << "0." << Stmt1 << " "
-                      << "0." << Stmt2 << " "
-                      << Utils::escape(Value1) << std::endl
-                      << "preview 0" << std::endl;
-            return clang_mutate::CreateTU(CI);
-        }
-        if (SetFunc) {
-            MutateCmd << "set-func "
-                      << "0." << Stmt1 << " "
-                      << Utils::escape(Value1) << std::endl
-                      << "preview 0" << std::endl;
-            return clang_mutate::CreateTU(CI);
-        }
-        if (Insert) {
-            MutateCmd << "get    0." << Stmt1 << " as $stmt" << std::endl
-                      << "insert 0." << Stmt2 << " $stmt" << std::endl
-                      << "preview 0" << std::endl;
-            return clang_mutate::CreateTU(CI);
-        }
-        if (Swap) {
-            MutateCmd << "swap 0." << Stmt1
-                      << " 0." << Stmt2 << std::endl
-                      << "preview 0" << std::endl;
-            return clang_mutate::CreateTU(CI);
-        }
-        if (Set) {
-            MutateCmd << "set 0." << Stmt1 << " "
-                      << Utils::escape(Value1) << std::endl
-                      << "preview 0" << std::endl;
-            return clang_mutate::CreateTU(CI);
-        }
-        if (Set2) {
-            MutateCmd << "set "
-                      << "0." << Stmt1 << " " << Utils::escape(Value1) << " "
-                      << "0." << Stmt2 << " " << Utils::escape(Value2)
-                      << std::endl
-                      << "preview 0" << std::endl;
-            return clang_mutate::CreateTU(CI);
         }
-        if (InsertV) {
-            MutateCmd << "insert 0." << Stmt1 << " "
-                      << Utils::escape(Value1) << std::endl
-                      << "preview 0" << std::endl;
-            return clang_mutate::CreateTU(CI);
-        }
-        if (Interactive) {
-            return clang_mutate::CreateTU(CI);
+    };
+
+    std::vector<std::thread> workers;
+    for (unsigned int i = 0; i < std::min<size_t>(jobs, paths.size()); ++i)
+        workers.push_back(std::thread(worker));
+    for (auto & t : workers)
+        t.join();
+
+    // Leave the last TU in progress, as a serial run would. The ids of
+    // any TUs which were never created are left empty.
+    for (size_t i = 0; i < paths.size(); ++i) {
+        for (size_t j = 0; j < commands[i].size(); ++j) {
+            clang_mutate::TU * tu = clang_mutate::TUs[first_tuids[i] + j];
+            if (tu != NULL)
+                clang_mutate::tu_in_progress = tu;
         }
-        
-        errs() << "Must supply one of:\n";
-        errs() << "\tnumber\n";
-        errs() << "\tids\n";
-        errs() << "\tannotate\n";
-        errs() << "\tlist\n";
-        errs() << "\tcut\n";
-        errs() << "\tinsert\n";
-        errs() << "\tswap\n";
-        errs() << "\tget\n";
-        errs() << "\tset\n";
-        errs() << "\tset2\n";
-        errs() << "\tset-range\n";
-        errs() << "\tinsert-value\n";
-        errs() << "\tinteractive\n";
-        
-        exit(EXIT_FAILURE);
-  }
+    }
 
-  clang::CompilerInstance * CI;
-};
+    // Report the most severe result, as ClangTool::run would: 1 if any
+    // file failed, otherwise 2 if any file was skipped.
+    int result = 0;
+    for (int r : results) {
+        if (r == 1 || (r == 2 && result == 0))
+            result = r;
+    }
+    return result;
+}
 }
 
 int process_command_line(int argc, const char **argv)
@@ -282,21 +432,70 @@ int process_command_line(int argc, const char **argv)
     static size_t processed = 0;
 
     CommonOptionsParser OptionsParser(argc, argv, ToolCategory);
+    clang_mutate::single_pass_requirements = SinglePassReqs;
+    clang_mutate::serialize_threads = std::max(1u, (unsigned int) SerializeJobs);
+    clang_mutate::batch_threads = std::max(1u, (unsigned int) Jobs);
+    clang_mutate::batch_diffs = Diff;
+
+    if (!File1.empty()) {
+        Value1 = Utils::filenameToContents(File1);
+    }
+    if (!File2.empty()) {
+        Value2 = Utils::filenameToContents(File2);
+    }
 
     std::vector<std::string> newPaths;
     auto srcPaths = OptionsParser.getSourcePathList();
     while (processed < srcPaths.size())
         newPaths.push_back(srcPaths[processed++]);
 
-    ClangTool Tool(OptionsParser.getCompilations(), newPaths);
-    ActionFactory Factory;
-    return Tool.run(newFAF<ActionFactory>(&Factory, &Factory).get());
+    clang_mutate::tu_cache_dir = CacheDir;
+
+    int result = run_jobs(OptionsParser.getCompilations(),
+                          newPaths,
+                          std::max(1u, (unsigned int) Jobs));
+
+    for (auto & cmds : TUCmds)
+        MutateCmd << cmds.second;
+    TUCmds.clear();
+
+    if (!CacheDir.empty()) {
+        clang_mutate::TUCacheStats stats = clang_mutate::tu_cache_stats();
+        size_t lookups = stats.hits + stats.misses;
+        errs() << "TU cache: " << stats.hits << "/" << lookups << " hits ("
+               << format("%.0f", lookups ? 100.0 * stats.hits / lookups : 0.0)
+               << "%), " << format("%.3f", stats.load_seconds)
+               << "s loading\n";
+    }
+
+    return result;
 }
 
 int main(int argc, const char **argv)
 {
     int result = process_command_line(argc, argv);
 
+    // Send output to a file instead, compressing it on a thread of its
+    // own as it is written.
+    std::unique_ptr<clang_mutate::OutputFileBuf> output;
+    std::streambuf * stdout_buf = NULL;
+    if (!Output.empty()) {
+        clang_mutate::Compression compression;
+        std::string error;
+        if (!clang_mutate::parseCompression(Compress, Output,
+                                            compression, error))
+        {
+            errs() << error << "\n";
+            return EXIT_FAILURE;
+        }
+        output.reset(new clang_mutate::OutputFileBuf(Output, compression));
+        if (!output->ok()) {
+            errs() << output->error() << "\n";
+            return EXIT_FAILURE;
+        }
+        stdout_buf = std::cout.rdbuf(output.get());
+    }
+
     if (Interactive) {
         clang_mutate::interactive_flags["ctrl"  ] = CtrlChar;
         clang_mutate::interactive_flags["prompt"] = !Silent;
@@ -308,6 +507,15 @@ int main(int argc, const char **argv)
         std::istringstream cmd(MutateCmd.str());
         clang_mutate::runInteractiveSession(cmd);
     }
-    
+
+    if (output) {
+        std::cout.flush();
+        std::cout.rdbuf(stdout_buf);
+        if (!output->close()) {
+            errs() << output->error() << "\n";
+            return EXIT_FAILURE;
+        }
+    }
+
     return result;
 }
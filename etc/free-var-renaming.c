@@ -0,0 +1,11 @@
+int global;
+
+int fun(int arg)
+{
+  int local = arg;
+  {
+    int inner = local + global;
+    local = inner;
+  }
+  return local;
+}
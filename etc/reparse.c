@@ -0,0 +1,12 @@
+int total = 0;
+
+int add(int a, int b)
+{
+    return a + b;
+}
+
+int main(void)
+{
+    total = add(1, 2);
+    return total;
+}
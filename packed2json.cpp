@@ -0,0 +1,33 @@
+// Decode a packed stream (see Packed.h) from stdin, and print its
+// records as a JSON array, just as `json` would have printed them.
+
+#include "Packed.h"
+
+#include <iostream>
+#include <iterator>
+#include <sstream>
+
+using namespace clang_mutate;
+
+int main()
+{
+    std::ostringstream in;
+    in << std::cin.rdbuf();
+    std::string bytes = in.str();
+
+    PackedReader reader(bytes);
+    picojson::value record;
+    const char * sep = "";
+    std::cout << "[";
+    while (reader.next(record)) {
+        std::cout << sep << record;
+        sep = ",";
+    }
+    std::cout << "]" << std::endl;
+
+    if (!reader.ok()) {
+        std::cerr << "packed2json: malformed input" << std::endl;
+        return 1;
+    }
+    return 0;
+}